@@ -1,26 +1,139 @@
-#include "btree.h"
+#include "btree_int.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+
+/* Add delta to the subtree count of child i */
+#if BTREE_ORDER_STATS
+#define count_step(node, i, delta) ((node)->counts[i] += (unsigned int)(delta))
+#else
+#define count_step(node, i, delta)
+#endif
+
+/* The pool's allocation, which the byte-plane layout rounds up to a page */
+#if BTREE_BYTE_PLANES
+#define pool_memory(pool) ((pool)->memory)
+#else
+#define pool_memory(pool) ((pool)->block)
+#endif
+
+/* A released pool node stores the free list link in its first bytes */
+typedef struct BTreeFreeNode
+{
+    BTreeNode *next;
+} BTreeFreeNode;
+
+static BTreeNode *pool_alloc(BTreePool *pool, unsigned char is_leaf)
+{
+    BTreeNode *node;
+    BTreeNode **free_list;
+    unsigned int size;
+    unsigned int offset;
+
+    if (is_leaf)
+    {
+        free_list = &pool->free_leaves;
+        size = BTREE_LEAF_SIZE;
+    }
+    else
+    {
+        free_list = &pool->free_nodes;
+        size = BTREE_NODE_SIZE;
+    }
+
+    offset = pool->carved;
+#if BTREE_BYTE_PLANES
+    /* Start a new page rather than straddle one */
+    if ((offset & 0xFF) + size > 0x100 && size <= 0x100)
+        offset = (offset + 0xFF) & ~0xFFU;
+#endif
+
+    if (*free_list)
+    {
+        node = *free_list;
+        *free_list = ((BTreeFreeNode *)node)->next;
+        pool->free_count--;
+    }
+    else if (offset <= pool->capacity && pool->capacity - offset >= size)
+    {
+        node = (BTreeNode *)(pool->block + offset);
+        pool->carved = offset + size;
+    }
+    else
+    {
+        pool->failures++;
+        return NULL;
+    }
+
+    pool->used += size;
+    pool->allocs++;
+    pool->live_nodes++;
+    if (pool->live_nodes > pool->peak_nodes)
+        pool->peak_nodes = pool->live_nodes;
+
+    return node;
+}
+
+static void pool_free(BTreePool *pool, BTreeNode *node)
+{
+    if (node->is_leaf)
+    {
+        ((BTreeFreeNode *)node)->next = pool->free_leaves;
+        pool->free_leaves = node;
+        pool->used -= BTREE_LEAF_SIZE;
+    }
+    else
+    {
+        ((BTreeFreeNode *)node)->next = pool->free_nodes;
+        pool->free_nodes = node;
+        pool->used -= BTREE_NODE_SIZE;
+    }
+    pool->free_count++;
+    pool->live_nodes--;
+    pool->frees++;
+}
 
-static BTreeNode *node_create(unsigned char is_leaf)
+BTreeNode *btree_node_create(BTree *tree, unsigned char is_leaf)
 {
     BTreeNode *node;
     unsigned char i;
 
-    node = (BTreeNode *)malloc(sizeof(BTreeNode));
+    if (tree->pool)
+        node = pool_alloc(tree->pool, is_leaf);
+    else if (is_leaf)
+        node = (BTreeNode *)malloc(BTREE_LEAF_SIZE);
+    else
+        node = (BTreeNode *)malloc(BTREE_NODE_SIZE);
     if (!node)
         return NULL;
 
     node->key_count = 0;
     node->is_leaf = is_leaf;
+#if BTREE_SNAPSHOTS
+    node->refs = 0;
+#endif
 
-    for (i = 0; i < BTREE_MAX_CHILDREN; i++)
-        node->children[i] = NULL;
+    if (!is_leaf)
+        for (i = 0; i < BTREE_MAX_CHILDREN; i++)
+        {
+            node->children[i] = NULL;
+#if BTREE_ORDER_STATS
+            node->counts[i] = 0;
+#endif
+        }
 
     return node;
 }
 
-BTree *btree_create(void)
+void btree_node_free(BTree *tree, BTreeNode *node)
+{
+    if (tree->pool)
+        pool_free(tree->pool, node);
+    else
+        free(node);
+}
+
+static BTree *btree_create_with(BTreePool *pool)
 {
     BTree *tree;
 
@@ -28,7 +141,18 @@ BTree *btree_create(void)
     if (!tree)
         return NULL;
 
-    tree->root = node_create(1);
+    tree->pool = pool;
+    tree->size = 0;
+    tree->split_policy = BTREE_SPLIT_MIDDLE;
+    tree->finger = NULL;
+    tree->finger_flags = 0;
+    tree->finger_hits = 0;
+    tree->finger_misses = 0;
+#if BTREE_FILTER
+    tree->filter = NULL;
+    tree->filter_stale = 0;
+#endif
+    tree->root = btree_node_create(tree, 1);
     if (!tree->root)
     {
         free(tree);
@@ -38,37 +162,390 @@ BTree *btree_create(void)
     return tree;
 }
 
-static void node_split_child(BTreeNode *parent, unsigned char index)
+BTree *btree_create(void)
+{
+#ifdef BTREE_USE_POOL
+    return btree_create_pool(BTREE_POOL_BYTES);
+#else
+    return btree_create_with(NULL);
+#endif
+}
+
+BTree *btree_create_pool(unsigned int pool_bytes)
+{
+    BTreePool *pool;
+    BTree *tree;
+
+    pool = (BTreePool *)malloc(sizeof(BTreePool));
+    if (!pool)
+        return NULL;
+
+#if BTREE_BYTE_PLANES
+    /* Round the block up to a page boundary */
+    if (pool_bytes + 0xFF < pool_bytes)
+        pool_bytes = ~0xFFU;
+    pool->memory = (unsigned char *)malloc(pool_bytes + 0xFF);
+    if (!pool->memory)
+    {
+        free(pool);
+        return NULL;
+    }
+    pool->block = pool->memory + ((0x100 - ((size_t)pool->memory & 0xFF)) & 0xFF);
+#else
+    pool->block = (unsigned char *)malloc(pool_bytes);
+    if (!pool->block)
+    {
+        free(pool);
+        return NULL;
+    }
+#endif
+
+    pool->capacity = pool_bytes;
+    pool->carved = 0;
+    pool->free_leaves = NULL;
+    pool->free_nodes = NULL;
+    pool->free_count = 0;
+    pool->used = 0;
+    pool->live_nodes = 0;
+    pool->peak_nodes = 0;
+    pool->allocs = 0;
+    pool->frees = 0;
+    pool->failures = 0;
+
+    tree = btree_create_with(pool);
+    if (!tree)
+    {
+        free(pool_memory(pool));
+        free(pool);
+    }
+
+    return tree;
+}
+
+unsigned char btree_pool_stats(BTree *tree, BTreePoolStats *stats)
+{
+    BTreePool *pool;
+
+    if (!tree || !tree->pool || !stats)
+        return 0;
+
+    pool = tree->pool;
+    stats->capacity = pool->capacity;
+    stats->used = pool->used;
+    stats->live_nodes = pool->live_nodes;
+    stats->peak_nodes = pool->peak_nodes;
+    stats->free_nodes = pool->free_count;
+    stats->allocs = pool->allocs;
+    stats->frees = pool->frees;
+    stats->failures = pool->failures;
+
+    return 1;
+}
+
+unsigned char btree_set_split_policy(BTree *tree, unsigned char policy)
+{
+    if (!tree || policy > BTREE_SPLIT_APPEND)
+        return 0;
+
+    tree->split_policy = policy;
+    return 1;
+}
+
+unsigned char btree_set_finger(BTree *tree, unsigned char enable)
+{
+    if (!tree)
+        return 0;
+
+    tree->finger = NULL;
+    tree->finger_flags = (unsigned char)(enable ? BTREE_FINGER_ON : 0);
+    tree->finger_hits = 0;
+    tree->finger_misses = 0;
+    return 1;
+}
+
+unsigned char btree_finger_stats(BTree *tree, BTreeFingerStats *stats)
+{
+    if (!tree || !(tree->finger_flags & BTREE_FINGER_ON) || !stats)
+        return 0;
+
+    stats->hits = tree->finger_hits;
+    stats->misses = tree->finger_misses;
+    return 1;
+}
+
+/* Returns 1 if key can only live in the finger leaf */
+static unsigned char finger_covers(BTree *tree, BTreeKey key)
+{
+    if (!tree->finger ||
+        ((tree->finger_flags & BTREE_FINGER_LO) && !BTREE_KEY_LESS(tree->finger_lo, key)) ||
+        ((tree->finger_flags & BTREE_FINGER_HI) && !BTREE_KEY_LESS(key, tree->finger_hi)))
+        return 0;
+
+    return 1;
+}
+
+/* Narrow the bounds of a descent that is about to follow children[i] */
+#define finger_narrow(node, i, lo, hi, bounds) \
+    do \
+    { \
+        if ((i) > 0) \
+        { \
+            (lo) = btree_key((node), (i) - 1); \
+            (bounds) |= BTREE_FINGER_LO; \
+        } \
+        if ((i) < (node)->key_count) \
+        { \
+            (hi) = btree_key((node), i); \
+            (bounds) |= BTREE_FINGER_HI; \
+        } \
+    } while (0)
+
+#if BTREE_ORDER_STATS
+/* A descent notes the count it passes at each level, so an insert through
+ * the finger can bump them without going back to the root. Splits, merges
+ * and borrows are the only moves of counts, and they drop the finger.
+ */
+#define finger_path_init() (depth = 0)
+#define finger_path_add(node, i) (path[depth++] = &(node)->counts[i])
+
+static void finger_set_path(BTree *tree, BTreeNode *leaf, BTreeKey lo, BTreeKey hi, unsigned char bounds,
+                            unsigned int **path, unsigned char depth)
+#else
+#define finger_path_init()
+#define finger_path_add(node, i)
+#define finger_set_path(tree, leaf, lo, hi, bounds, path, depth) finger_set(tree, leaf, lo, hi, bounds)
+
+static void finger_set(BTree *tree, BTreeNode *leaf, BTreeKey lo, BTreeKey hi, unsigned char bounds)
+#endif
+{
+    if (!(tree->finger_flags & BTREE_FINGER_ON))
+        return;
+
+    tree->finger = leaf;
+    tree->finger_lo = lo;
+    tree->finger_hi = hi;
+    tree->finger_flags = (unsigned char)(BTREE_FINGER_ON | bounds);
+#if BTREE_ORDER_STATS
+    memcpy(tree->finger_counts, path, depth * sizeof(path[0]));
+    tree->finger_depth = depth;
+#endif
+}
+
+/* Node holding key, or the leaf where the search for it ends. The index
+ * of the first key >= key in that node goes to *index.
+ */
+static BTreeNode *node_locate(BTree *tree, BTreeKey key, unsigned char *index)
+{
+    BTreeNode *node;
+    unsigned char i;
+    BTreeKey lo;
+    BTreeKey hi;
+    unsigned char bounds;
+#if BTREE_ORDER_STATS
+    unsigned int *path[BTREE_MAX_HEIGHT];
+    unsigned char depth;
+#endif
+#if BTREE_SNAPSHOTS
+    unsigned char shared;
+#endif
+
+    if (finger_covers(tree, key))
+    {
+        tree->finger_hits++;
+        *index = node_find(tree->finger, key);
+        return tree->finger;
+    }
+
+    if (tree->finger_flags & BTREE_FINGER_ON)
+        tree->finger_misses++;
+
+    node = tree->root;
+    lo = 0;
+    hi = 0;
+    bounds = 0;
+    finger_path_init();
+#if BTREE_SNAPSHOTS
+    shared = 0;
+#endif
+
+    while (1)
+    {
+        i = node_find(node, key);
+#if BTREE_SNAPSHOTS
+        shared |= node->refs;
+#endif
+
+        if (node->is_leaf)
+        {
+#if BTREE_SNAPSHOTS
+            /* Writes through the finger skip copying, so it must not be shared */
+            if (!shared)
+#endif
+                finger_set_path(tree, node, lo, hi, bounds, path, depth);
+            break;
+        }
+
+        if (i < node->key_count && BTREE_KEY_EQ(key, btree_key(node, i)))
+            break;
+
+        finger_narrow(node, i, lo, hi, bounds);
+        finger_path_add(node, i);
+        node = node->children[i];
+    }
+
+    *index = i;
+    return node;
+}
+
+#if BTREE_SNAPSHOTS
+/* node_locate for a write: copies the shared nodes on the way down.
+ * NULL when out of memory.
+ */
+static BTreeNode *node_locate_own(BTree *tree, BTreeKey key, unsigned char *index)
+{
+    BTreeNode *node;
+    unsigned char i;
+    BTreeKey lo;
+    BTreeKey hi;
+    unsigned char bounds;
+#if BTREE_ORDER_STATS
+    unsigned int *path[BTREE_MAX_HEIGHT];
+    unsigned char depth;
+#endif
+
+    if (finger_covers(tree, key))
+        return node_locate(tree, key, index);
+
+    if (tree->finger_flags & BTREE_FINGER_ON)
+        tree->finger_misses++;
+
+    i = 0;
+    lo = 0;
+    hi = 0;
+    bounds = 0;
+    finger_path_init();
+    node = node_own(tree, &tree->root);
+
+    while (node)
+    {
+        i = node_find(node, key);
+
+        if (node->is_leaf)
+        {
+            finger_set_path(tree, node, lo, hi, bounds, path, depth);
+            break;
+        }
+
+        if (i < node->key_count && BTREE_KEY_EQ(key, btree_key(node, i)))
+            break;
+
+        finger_narrow(node, i, lo, hi, bounds);
+        finger_path_add(node, i);
+        node = node_own(tree, &node->children[i]);
+    }
+
+    *index = i;
+    return node;
+}
+#else
+#define node_locate_own(tree, key, index) node_locate(tree, key, index)
+#endif
+
+#if BTREE_ORDER_STATS
+unsigned int btree_node_total(BTreeNode *node)
+{
+    unsigned int total;
+    unsigned char i;
+
+    total = node->key_count;
+    if (!node->is_leaf)
+        for (i = 0; i <= node->key_count; i++)
+            total += node->counts[i];
+
+    return total;
+}
+
+/* Add delta to the counts on the search path for key, from the root down
+ * to stop (or the leaf when stop is NULL)
+ */
+static void counts_adjust(BTree *tree, BTreeKey key, BTreeNode *stop, int delta)
+{
+    BTreeNode *node;
+    unsigned char i;
+
+    node = tree->root;
+    while (node != stop && !node->is_leaf)
+    {
+        i = node_find(node, key);
+        count_step(node, i, delta);
+        node = node->children[i];
+    }
+}
+#else
+#define counts_adjust(tree, key, stop, delta)
+#endif
+
+void btree_leaf_insert(BTreeNode *node, unsigned char i, BTreeKey key, BTreeValue value)
+{
+    node_open(node, i);
+    btree_key_set(node, i, key);
+    node->values[i] = value;
+    node->key_count++;
+}
+
+/* Where to split a full child on the way to key. right_edge is set while
+ * the descent has only followed last children, so a key above every key
+ * in the child is being appended past the end of the tree.
+ */
+static unsigned char split_point(BTree *tree, BTreeNode *full_child, BTreeKey key, unsigned char right_edge)
+{
+    if (right_edge && tree->split_policy == BTREE_SPLIT_APPEND &&
+        BTREE_KEY_LESS(btree_key(full_child, BTREE_MAX_KEYS - 1), key))
+        return full_child->is_leaf ? (unsigned char)(BTREE_MAX_KEYS - 1) : BTREE_APPEND_SPLIT_INDEX;
+
+    return BTREE_SPLIT_INDEX;
+}
+
+/* Split the full child at index around keys[mid], which moves up */
+static unsigned char node_split_child(BTree *tree, BTreeNode *parent, unsigned char index, unsigned char mid)
 {
     BTreeNode *full_child;
     BTreeNode *new_node;
     unsigned char i;
     unsigned char move_keys;
     unsigned char move_children;
-    unsigned char mid;
+#if BTREE_ORDER_STATS
+    unsigned int right_total;
+#endif
 
     full_child = parent->children[index];
-    new_node = node_create(full_child->is_leaf);
+    new_node = btree_node_create(tree, full_child->is_leaf);
 
     if (!new_node)
-        return;
-    mid = BTREE_SPLIT_INDEX;
+        return 0; /* Out of memory, leave the child full */
+
+    btree_finger_drop(tree);
     move_keys = (unsigned char)(BTREE_MAX_KEYS - mid - 1);
     move_children = (unsigned char)(BTREE_MAX_CHILDREN - mid - 1);
 
     /* Move upper half keys/values to new node */
-    for (i = 0; i < move_keys; i++)
-    {
-        new_node->keys[i] = full_child->keys[mid + 1 + i];
-        new_node->values[i] = full_child->values[mid + 1 + i];
-    }
+    node_copy(new_node, 0, full_child, (unsigned char)(mid + 1), move_keys);
     new_node->key_count = move_keys;
 
     /* Move upper children if internal */
+#if BTREE_ORDER_STATS
+    right_total = move_keys;
+#endif
     if (!full_child->is_leaf)
     {
         for (i = 0; i < move_children; i++)
+        {
             new_node->children[i] = full_child->children[mid + 1 + i];
+#if BTREE_ORDER_STATS
+            new_node->counts[i] = full_child->counts[mid + 1 + i];
+            right_total += new_node->counts[i];
+#endif
+        }
     }
 
     /* Shrink full child */
@@ -76,141 +553,253 @@ static void node_split_child(BTreeNode *parent, unsigned char index)
 
     /* Shift parent children to make room */
     for (i = parent->key_count + 1; i > index + 1; i--)
+    {
         parent->children[i] = parent->children[i - 1];
+#if BTREE_ORDER_STATS
+        parent->counts[i] = parent->counts[i - 1];
+#endif
+    }
+
+    /* The promoted key leaves the child's subtree */
+#if BTREE_ORDER_STATS
+    parent->counts[index] -= right_total + 1;
+    parent->counts[index + 1] = right_total;
+#endif
 
     /* Shift parent keys/values */
-    for (i = parent->key_count; i > index; i--)
-    {
-        parent->keys[i] = parent->keys[i - 1];
-        parent->values[i] = parent->values[i - 1];
-    }
+    node_open(parent, index);
 
     /* Promote middle key to parent */
-    parent->keys[index] = full_child->keys[mid];
+    btree_key_copy(parent, index, full_child, mid);
     parent->values[index] = full_child->values[mid];
     parent->children[index + 1] = new_node;
     parent->key_count++;
+
+    return 1;
 }
 
-static void btree_insert_non_full(BTreeNode *node, unsigned int key, void *value)
+/* Insert key below a node that is not full, with value if it is new.
+ * Returns the key's value slot, NULL when out of memory.
+ */
+static BTreeValue *btree_insert_non_full(BTree *tree, BTreeNode *node, BTreeKey key, BTreeValue value)
 {
-    int i;
-
-    i = node->key_count - 1;
-
-    if (node->is_leaf)
+    unsigned char i;
+    unsigned char right_edge;
+    BTreeKey lo;
+    BTreeKey hi;
+    unsigned char bounds;
+#if BTREE_ORDER_STATS
+    unsigned int *path[BTREE_MAX_HEIGHT];
+    unsigned char depth;
+#endif
+
+    right_edge = 1;
+    lo = 0;
+    hi = 0;
+    bounds = 0;
+    finger_path_init();
+    while (1)
     {
-        /* Insert key in sorted position */
-        while (i >= 0 && key < node->keys[i])
-        {
-            node->keys[i + 1] = node->keys[i];
-            node->values[i + 1] = node->values[i];
-            i--;
-        }
+        i = node_find(node, key);
 
         /* Check for duplicate */
-        if (i >= 0 && key == node->keys[i])
+        if (i < node->key_count && BTREE_KEY_EQ(key, btree_key(node, i)))
         {
-            node->values[i] = value;
-            return;
+            counts_adjust(tree, key, node, -1);
+            return &node->values[i];
         }
 
-        node->keys[i + 1] = key;
-        node->values[i + 1] = value;
-        node->key_count++;
-    }
-    else
-    {
-        /* Find child to insert into */
-        while (i >= 0 && key < node->keys[i])
-            i--;
-
-        /* Check for duplicate */
-        if (i >= 0 && key == node->keys[i])
+        if (node->is_leaf)
         {
-            node->values[i] = value;
-            return;
+            btree_leaf_insert(node, i, key, value);
+            tree->size++;
+            finger_set_path(tree, node, lo, hi, bounds, path, depth);
+            return &node->values[i];
         }
 
-        i++;
+        /* Copy a child shared with another tree before changing it */
+        if (!node_own(tree, &node->children[i]))
+        {
+            counts_adjust(tree, key, node, -1);
+            return NULL;
+        }
 
         /* Split child if full */
         if (node->children[i]->key_count == BTREE_MAX_KEYS)
         {
-            node_split_child(node, i);
+            if (!node_split_child(tree, node, i,
+                                  split_point(tree, node->children[i], key, right_edge && i == node->key_count)))
+            {
+                counts_adjust(tree, key, node, -1);
+                return NULL;
+            }
+
+            /* The promoted key may be the one being inserted */
+            if (BTREE_KEY_EQ(key, btree_key(node, i)))
+            {
+                counts_adjust(tree, key, node, -1);
+                return &node->values[i];
+            }
 
-            if (key > node->keys[i])
+            if (BTREE_KEY_LESS(btree_key(node, i), key))
                 i++;
         }
 
-        btree_insert_non_full(node->children[i], key, value);
+        /* Counted on the way down; a duplicate takes it back */
+        if (i != node->key_count)
+            right_edge = 0;
+        count_step(node, i, 1);
+        finger_narrow(node, i, lo, hi, bounds);
+        finger_path_add(node, i);
+        node = node->children[i];
     }
 }
 
-void btree_insert(BTree *tree, unsigned int key, void *value)
+/* btree_insert() without storing the value over a present key's. Returns
+ * the key's value slot, NULL when out of memory.
+ */
+static BTreeValue *insert_slot(BTree *tree, BTreeKey key, BTreeValue value)
 {
     BTreeNode *new_root;
+    BTreeNode *node;
+    unsigned char i;
+#if BTREE_ORDER_STATS
+    unsigned char d;
+#endif
+
+#if BTREE_FILTER
+    /* Set before the insert; bits for a key that fails to go in are harmless */
+    if (tree->filter)
+        btree_filter_add(tree, key);
+#endif
+
+    /* A finger leaf with room takes the key without a descent */
+    if (finger_covers(tree, key))
+    {
+        node = tree->finger;
+        i = node_find(node, key);
+        if (i < node->key_count && BTREE_KEY_EQ(key, btree_key(node, i)))
+        {
+            tree->finger_hits++;
+            return &node->values[i];
+        }
+        if (node->key_count < BTREE_MAX_KEYS)
+        {
+            tree->finger_hits++;
+            btree_leaf_insert(node, i, key, value);
+            tree->size++;
+#if BTREE_ORDER_STATS
+            for (d = 0; d < tree->finger_depth; d++)
+                (*tree->finger_counts[d])++;
+#endif
+            return &node->values[i];
+        }
+        /* Full leaf: it must split on the way down */
+    }
 
-    if (!tree || !tree->root)
-        return;
+    if (tree->finger_flags & BTREE_FINGER_ON)
+        tree->finger_misses++;
+
+    if (!node_own(tree, &tree->root))
+        return NULL; /* Out of memory copying a shared root */
 
     if (tree->root->key_count == BTREE_MAX_KEYS)
     {
         /* Root is full, split it */
-        new_root = node_create(0);
+        new_root = btree_node_create(tree, 0);
         if (!new_root)
-            return;
+            return NULL;
 
         new_root->children[0] = tree->root;
-        node_split_child(new_root, 0);
+#if BTREE_ORDER_STATS
+        new_root->counts[0] = tree->size;
+#endif
+        if (!node_split_child(tree, new_root, 0, split_point(tree, tree->root, key, 1)))
+        {
+            btree_node_free(tree, new_root);
+            return NULL;
+        }
         tree->root = new_root;
     }
 
-    btree_insert_non_full(tree->root, key, value);
+    return btree_insert_non_full(tree, tree->root, key, value);
 }
 
-static void *btree_search_node(BTreeNode *node, unsigned int key)
+void btree_insert(BTree *tree, BTreeKey key, BTreeValue value)
 {
-    unsigned char i;
-
-    i = 0;
-    while (i < node->key_count && key > node->keys[i])
-        i++;
-
-    if (i < node->key_count && key == node->keys[i])
-        return node->values[i];
+    BTreeValue *slot;
 
-    if (node->is_leaf)
-        return NULL; /* Not found */
+    if (!tree || !tree->root)
+        return;
 
-    return btree_search_node(node->children[i], key);
+    slot = insert_slot(tree, key, value);
+    if (slot)
+        *slot = value;
 }
 
-static unsigned int btree_count_nodes_internal(BTreeNode *node)
+static unsigned int btree_count_nodes_internal(BTreeNode *node, unsigned char leaves_only)
 {
+    BTreeNode *path[BTREE_MAX_HEIGHT];
+    unsigned char next[BTREE_MAX_HEIGHT];
+    unsigned char top;
     unsigned int count;
-    unsigned char i;
 
-    if (!node)
-        return 0;
+    if (node->is_leaf)
+        return 1;
 
-    count = 1;
+    /* Depth-first walk with an explicit path instead of recursion */
+    count = leaves_only ? 0 : 1;
+    path[0] = node;
+    next[0] = 0;
+    top = 0;
 
-    if (!node->is_leaf)
+    while (1)
     {
-        for (i = 0; i <= node->key_count; i++)
-            count = (unsigned int)(count + btree_count_nodes_internal(node->children[i]));
+        node = path[top];
+        if (next[top] > node->key_count)
+        {
+            if (top == 0)
+                break;
+            top--;
+            continue;
+        }
+
+        node = node->children[next[top]];
+        next[top]++;
+
+        if (node->is_leaf)
+            count++;
+        else if (top + 1 < BTREE_MAX_HEIGHT)
+        {
+            if (!leaves_only)
+                count++;
+            top++;
+            path[top] = node;
+            next[top] = 0;
+        }
     }
 
     return count;
 }
 
-void *btree_get(BTree *tree, unsigned int key)
+BTreeValue btree_get(BTree *tree, BTreeKey key)
 {
+    BTreeNode *node;
+    unsigned char i;
+
     if (!tree || !tree->root)
-        return NULL;
+        return BTREE_VALUE_NONE;
 
-    return btree_search_node(tree->root, key);
+#if BTREE_FILTER
+    if (tree->filter && !btree_filter_test(tree, key))
+        return BTREE_VALUE_NONE;
+#endif
+
+    node = node_locate(tree, key, &i);
+    if (i < node->key_count && BTREE_KEY_EQ(key, btree_key(node, i)))
+        return node->values[i];
+
+    return BTREE_VALUE_NONE; /* Not found */
 }
 
 unsigned int btree_node_count(BTree *tree)
@@ -218,10 +807,37 @@ unsigned int btree_node_count(BTree *tree)
     if (!tree || !tree->root)
         return 0;
 
-    return btree_count_nodes_internal(tree->root);
+    return btree_count_nodes_internal(tree->root, 0);
+}
+
+unsigned int btree_leaf_count(BTree *tree)
+{
+    if (!tree || !tree->root)
+        return 0;
+
+    return btree_count_nodes_internal(tree->root, 1);
 }
 
-unsigned char btree_update(BTree *tree, unsigned int key, void *new_value)
+unsigned int btree_size(BTree *tree)
+{
+    if (!tree)
+        return 0;
+
+    return tree->size;
+}
+
+unsigned int btree_memory_usage(BTree *tree)
+{
+    unsigned int nodes;
+    unsigned int leaves;
+
+    nodes = btree_node_count(tree);
+    leaves = btree_leaf_count(tree);
+
+    return (unsigned int)(leaves * BTREE_LEAF_SIZE + (nodes - leaves) * BTREE_NODE_SIZE);
+}
+
+unsigned char btree_update(BTree *tree, BTreeKey key, BTreeValue new_value)
 {
     BTreeNode *node;
     unsigned char i;
@@ -229,277 +845,556 @@ unsigned char btree_update(BTree *tree, unsigned int key, void *new_value)
     if (!tree || !tree->root)
         return 0;
 
-    node = tree->root;
-
-    while (node)
+    node = node_locate_own(tree, key, &i);
+    if (node && i < node->key_count && BTREE_KEY_EQ(key, btree_key(node, i)))
     {
-        i = 0;
-        while (i < node->key_count && key > node->keys[i])
-            i++;
+        node->values[i] = new_value;
+        return 1;
+    }
 
-        if (i < node->key_count && key == node->keys[i])
-        {
-            node->values[i] = new_value;
-            return 1;
-        }
+    return 0;
+}
 
-        if (node->is_leaf)
-            return 0;
+BTreeValue *btree_get_slot(BTree *tree, BTreeKey key, unsigned char create)
+{
+    BTreeNode *node;
+    unsigned char i;
 
-        node = node->children[i];
+    if (!tree || !tree->root)
+        return NULL;
+
+    /* The caller may write through the slot, so the path is copied as for
+     * btree_update(). A present key leaves the tree's shape and counts
+     * alone.
+     */
+#if BTREE_FILTER
+    if (!tree->filter || btree_filter_test(tree, key))
+#endif
+    {
+        node = node_locate_own(tree, key, &i);
+        if (!node)
+            return NULL;
+        if (i < node->key_count && BTREE_KEY_EQ(key, btree_key(node, i)))
+            return &node->values[i];
     }
 
-    return 0;
+    if (!create)
+        return NULL;
+
+    /* A finger left on the leaf just searched takes the key if it has room */
+    return insert_slot(tree, key, BTREE_VALUE_NONE);
 }
 
-static void merge_nodes(BTreeNode *parent, unsigned char index)
+unsigned char btree_upsert(BTree *tree, BTreeKey key, BTreeUpsert fn, void *ctx)
+{
+    BTreeValue *slot;
+
+    if (!fn)
+        return 0;
+
+    slot = btree_get_slot(tree, key, 1);
+    if (!slot)
+        return 0;
+
+    *slot = fn(key, *slot, ctx);
+    return 1;
+}
+
+static void merge_nodes(BTree *tree, BTreeNode *parent, unsigned char index)
 {
     BTreeNode *left;
     BTreeNode *right;
     unsigned char i;
 
+    btree_finger_drop(tree);
     left = parent->children[index];
     right = parent->children[index + 1];
 
     /* Bring parent separator down */
-    left->keys[left->key_count] = parent->keys[index];
+    btree_key_copy(left, left->key_count, parent, index);
     left->values[left->key_count] = parent->values[index];
 
     /* Append right node keys */
-    for (i = 0; i < right->key_count; i++)
-    {
-        left->keys[left->key_count + 1 + i] = right->keys[i];
-        left->values[left->key_count + 1 + i] = right->values[i];
-    }
+    node_copy(left, (unsigned char)(left->key_count + 1), right, 0, right->key_count);
 
     /* Append right children if internal */
     if (!left->is_leaf)
     {
         for (i = 0; i <= right->key_count; i++)
+        {
             left->children[left->key_count + 1 + i] = right->children[i];
+#if BTREE_ORDER_STATS
+            left->counts[left->key_count + 1 + i] = right->counts[i];
+#endif
+        }
     }
 
     left->key_count = (unsigned char)(left->key_count + 1 + right->key_count);
 
     /* Shift parent keys/children to close gap */
-    for (i = index; i < parent->key_count - 1; i++)
-    {
-        parent->keys[i] = parent->keys[i + 1];
-        parent->values[i] = parent->values[i + 1];
-    }
+    node_close(parent, index);
     
+    /* The separator and the right subtree now count under left */
+    count_step(parent, index, parent->counts[index + 1] + 1);
+
     /* Shift children - need to close the gap from merged right node */
     for (i = index + 1; i < parent->key_count; i++)
     {
         parent->children[i] = parent->children[i + 1];
+#if BTREE_ORDER_STATS
+        parent->counts[i] = parent->counts[i + 1];
+#endif
     }
 
     parent->key_count--;
-    free(right);
+    btree_node_free(tree, right);
 }
 
-static void btree_delete_node(BTreeNode *node, unsigned int key)
+/* Bring child i of node above BTREE_MIN_KEYS keys by borrowing from a
+ * sibling or merging with one, so a descent into it can take a key away.
+ * Repeats until the child has enough, which also refills nodes that have
+ * lost many keys. Returns the child's index, which a merge with the left
+ * sibling moves down by one.
+ */
+unsigned char btree_node_top_up(BTree *tree, BTreeNode *node, unsigned char i)
 {
-    unsigned char i;
     BTreeNode *child;
     BTreeNode *left;
     BTreeNode *right;
     unsigned char j;
+#if BTREE_ORDER_STATS
+    unsigned int moved;
+#endif
 
-    i = 0;
-    while (i < node->key_count && key > node->keys[i])
-        i++;
+    child = node_own(tree, &node->children[i]);
+    if (!child)
+        return BTREE_NO_CHILD;
 
-    if (i < node->key_count && key == node->keys[i])
+    while (child->key_count <= BTREE_MIN_KEYS && node->key_count > 0)
     {
-        if (node->is_leaf)
+        btree_finger_drop(tree);
+        if (i > 0 && node->children[i - 1]->key_count > BTREE_MIN_KEYS)
         {
-            /* Simple case: key is in leaf */
-            while (i < node->key_count - 1)
+            /* Borrow from left sibling */
+            left = node_own(tree, &node->children[i - 1]);
+            if (!left)
+                return BTREE_NO_CHILD;
+
+            node_open(child, 0);
+            if (!child->is_leaf)
+                for (j = child->key_count + 1; j > 0; j--)
+                {
+                    child->children[j] = child->children[j - 1];
+#if BTREE_ORDER_STATS
+                    child->counts[j] = child->counts[j - 1];
+#endif
+                }
+
+            btree_key_copy(child, 0, node, i - 1);
+            child->values[0] = node->values[i - 1];
+#if BTREE_ORDER_STATS
+            moved = 1;
+#endif
+            if (!child->is_leaf)
             {
-                node->keys[i] = node->keys[i + 1];
-                node->values[i] = node->values[i + 1];
-                i++;
+                child->children[0] = left->children[left->key_count];
+#if BTREE_ORDER_STATS
+                child->counts[0] = left->counts[left->key_count];
+                moved += child->counts[0];
+#endif
             }
-            node->key_count--;
+            count_step(node, i - 1, -(int)moved);
+            count_step(node, i, moved);
+
+            btree_key_copy(node, i - 1, left, left->key_count - 1);
+            node->values[i - 1] = left->values[left->key_count - 1];
+
+            left->key_count--;
+            child->key_count++;
         }
-        else
+        else if (i < node->key_count && node->children[i + 1]->key_count > BTREE_MIN_KEYS)
         {
-            /* Internal node: choose predecessor or successor; otherwise merge */
-            unsigned int promote_key;
-            left = node->children[i];
-            right = node->children[i + 1];
+            /* Borrow from right sibling */
+            right = node_own(tree, &node->children[i + 1]);
+            if (!right)
+                return BTREE_NO_CHILD;
+
+            btree_key_copy(child, child->key_count, node, i);
+            child->values[child->key_count] = node->values[i];
+#if BTREE_ORDER_STATS
+            moved = 1;
+#endif
+            if (!child->is_leaf)
+            {
+                child->children[child->key_count + 1] = right->children[0];
+#if BTREE_ORDER_STATS
+                child->counts[child->key_count + 1] = right->counts[0];
+                moved += right->counts[0];
+#endif
+            }
+            count_step(node, i, moved);
+            count_step(node, i + 1, -(int)moved);
+
+            btree_key_copy(node, i, right, 0);
+            node->values[i] = right->values[0];
 
-            if (left->key_count > BTREE_MIN_KEYS)
+            node_close(right, 0);
+            if (!right->is_leaf)
             {
-                promote_key = left->keys[left->key_count - 1];
-                node->keys[i] = promote_key;
-                node->values[i] = left->values[left->key_count - 1];
-                btree_delete_node(left, promote_key);
+                for (j = 0; j < right->key_count; j++)
+                {
+                    right->children[j] = right->children[j + 1];
+#if BTREE_ORDER_STATS
+                    right->counts[j] = right->counts[j + 1];
+#endif
+                }
             }
-            else if (right->key_count > BTREE_MIN_KEYS)
+
+            right->key_count--;
+            child->key_count++;
+        }
+        else
+        {
+            /* Merge with sibling */
+            if (i < node->key_count)
             {
-                promote_key = right->keys[0];
-                node->keys[i] = promote_key;
-                node->values[i] = right->values[0];
-                btree_delete_node(right, promote_key);
+                if (!node_own(tree, &node->children[i + 1]))
+                    return BTREE_NO_CHILD;
+                merge_nodes(tree, node, i);
             }
             else
             {
-                merge_nodes(node, i);
-                btree_delete_node(left, key);
+                if (!node_own(tree, &node->children[i - 1]))
+                    return BTREE_NO_CHILD;
+                merge_nodes(tree, node, (unsigned char)(i - 1));
+                i = (unsigned char)(i - 1);
             }
+
+            child = node->children[i];
         }
     }
-    else if (!node->is_leaf)
+
+    return i;
+}
+
+/* Returns 1 if the key was found and removed. A key in an internal node
+ * is replaced by its predecessor or successor only once that has left its
+ * leaf, and subtree counts drop only on success, so running out of memory
+ * for a copy of a shared node stops the delete with the tree intact.
+ */
+static unsigned char btree_delete_node(BTree *tree, BTreeNode *node, BTreeKey key)
+{
+    unsigned char i;
+    BTreeNode *child;
+    BTreeNode *holder;
+    unsigned char slot;
+#if BTREE_ORDER_STATS
+    BTreeNode *path[BTREE_MAX_HEIGHT];
+    unsigned char taken[BTREE_MAX_HEIGHT];
+    unsigned char depth;
+
+    depth = 0;
+#endif
+    holder = NULL;
+    slot = 0;
+
+    /* Top-down: every child is topped up before we descend into it, so the
+     * loop never has to come back up the tree.
+     */
+    while (1)
     {
-        child = node->children[i];
+        i = node_find(node, key);
 
-        if (child->key_count == BTREE_MIN_KEYS)
+        if (i < node->key_count && BTREE_KEY_EQ(key, btree_key(node, i)))
         {
-            if (i > 0 && node->children[i - 1]->key_count > BTREE_MIN_KEYS)
+            if (node->is_leaf)
             {
-                /* Borrow from left sibling */
-                left = node->children[i - 1];
-
-                for (j = child->key_count; j > 0; j--)
+                /* A predecessor or successor moves up over the deleted key */
+                if (holder)
                 {
-                    child->keys[j] = child->keys[j - 1];
-                    child->values[j] = child->values[j - 1];
+                    btree_key_set(holder, slot, key);
+                    holder->values[slot] = node->values[i];
                 }
-                if (!child->is_leaf)
-                    for (j = child->key_count + 1; j > 0; j--)
-                        child->children[j] = child->children[j - 1];
 
-                child->keys[0] = node->keys[i - 1];
-                child->values[0] = node->values[i - 1];
-                if (!child->is_leaf)
-                    child->children[0] = left->children[left->key_count];
+                node_close(node, i);
+                node->key_count--;
 
-                node->keys[i - 1] = left->keys[left->key_count - 1];
-                node->values[i - 1] = left->values[left->key_count - 1];
-
-                left->key_count--;
-                child->key_count++;
+#if BTREE_ORDER_STATS
+                while (depth > 0)
+                {
+                    depth--;
+                    path[depth]->counts[taken[depth]]--;
+                }
+#endif
+                return 1;
             }
-            else if (i < node->key_count && node->children[i + 1]->key_count > BTREE_MIN_KEYS)
-            {
-                /* Borrow from right sibling */
-                right = node->children[i + 1];
 
-                child->keys[child->key_count] = node->keys[i];
-                child->values[child->key_count] = node->values[i];
-                if (!child->is_leaf)
-                    child->children[child->key_count + 1] = right->children[0];
-
-                node->keys[i] = right->keys[0];
-                node->values[i] = right->values[0];
+            /* Internal node: replace with predecessor or successor; otherwise merge.
+             * Either way a separator changes, which moves the finger's bounds.
+             */
+            btree_finger_drop(tree);
+            if (node->children[i]->key_count > BTREE_MIN_KEYS)
+            {
+                child = node->children[i];
+                while (!child->is_leaf)
+                    child = child->children[child->key_count];
 
-                for (j = 0; j < right->key_count - 1; j++)
-                {
-                    right->keys[j] = right->keys[j + 1];
-                    right->values[j] = right->values[j + 1];
-                }
-                if (!right->is_leaf)
-                {
-                    for (j = 0; j < right->key_count; j++)
-                        right->children[j] = right->children[j + 1];
-                }
+                holder = node;
+                slot = i;
+                key = btree_key(child, child->key_count - 1);
+            }
+            else if (node->children[i + 1]->key_count > BTREE_MIN_KEYS)
+            {
+                child = node->children[i + 1];
+                while (!child->is_leaf)
+                    child = child->children[0];
 
-                right->key_count--;
-                child->key_count++;
+                holder = node;
+                slot = i;
+                key = btree_key(child, 0);
+                i++;
             }
             else
             {
-                /* Merge with sibling */
-                if (i < node->key_count)
-                {
-                    merge_nodes(node, i);
-                }
-                else
-                {
-                    merge_nodes(node, (unsigned char)(i - 1));
-                    i = (unsigned char)(i - 1);
-                }
-
-                child = node->children[i];
+                if (!node_own(tree, &node->children[i]) || !node_own(tree, &node->children[i + 1]))
+                    return 0;
+                merge_nodes(tree, node, i);
             }
+
+            child = node_own(tree, &node->children[i]);
+            if (!child)
+                return 0;
+        }
+        else
+        {
+            if (node->is_leaf)
+                return 0; /* Not found */
+
+            /* Append splits can leave right-edge nodes below the minimum */
+            i = btree_node_top_up(tree, node, i);
+            if (i == BTREE_NO_CHILD)
+                return 0;
+            child = node->children[i];
         }
 
-        btree_delete_node(child, key);
+        /* Counted off once the key is gone */
+#if BTREE_ORDER_STATS
+        path[depth] = node;
+        taken[depth] = i;
+        depth++;
+#endif
+        node = child;
     }
 }
 
-unsigned char btree_delete(BTree *tree, unsigned int key)
+unsigned char btree_delete(BTree *tree, BTreeKey key)
 {
+    unsigned char found;
+
     if (!tree || !tree->root)
         return 0;
 
-    if (btree_get(tree, key) == NULL)
+#ifdef BTREE_DEBUG_VERIFY
+    if (btree_get(tree, key) == BTREE_VALUE_NONE)
         return 0; /* Key not found */
+#endif
+
+    if (!node_own(tree, &tree->root))
+        return 0; /* Out of memory copying a shared root */
 
-    btree_delete_node(tree->root, key);
+    found = btree_delete_node(tree, tree->root, key);
 
+    /* Merges on the way down may have emptied the root, even on a miss */
     if (tree->root->key_count == 0 && !tree->root->is_leaf && tree->root->children[0])
     {
         BTreeNode *old_root;
         old_root = tree->root;
         tree->root = old_root->children[0];
-        free(old_root);
+        btree_node_free(tree, old_root);
     }
 
+    if (found)
+    {
+        tree->size--;
+#if BTREE_FILTER
+        tree->filter_stale++;
+#endif
+    }
+
+#ifdef BTREE_DEBUG_VERIFY
     /* Verify deletion was successful */
-    if (btree_get(tree, key) != NULL)
+    if (btree_get(tree, key) != BTREE_VALUE_NONE)
         return 0; /* Delete failed - key still exists */
+#endif
 
-    return 1;
+    return found;
 }
 
-static void btree_print_node(BTreeNode *node, int depth)
+void btree_print(BTree *tree)
 {
+    BTreeNode *path[BTREE_MAX_HEIGHT];
+    unsigned char next[BTREE_MAX_HEIGHT];
+    BTreeNode *node;
+    unsigned char top;
     unsigned char i;
-    int j;
 
-    if (!node)
+    if (!tree || !tree->root)
+    {
+        puts("Empty tree");
         return;
+    }
+
+    puts("B-tree structure:");
 
-    for (j = 0; j < depth; j++)
-        putchar(' ');
+    path[0] = tree->root;
+    next[0] = 0;
+    top = 0;
 
-    printf("Node: ");
-    for (i = 0; i < node->key_count; i++)
-        printf("[%d:%d] ", node->keys[i], node->values[i]);
-    putchar('\n');
+    while (1)
+    {
+        node = path[top];
 
-    if (!node->is_leaf)
-        for (i = 0; i <= node->key_count; i++)
-            btree_print_node(node->children[i], depth + 2);
+        /* Print each node the first time it is reached */
+        if (next[top] == 0)
+        {
+            for (i = 0; i < top; i++)
+            {
+                putchar(' ');
+                putchar(' ');
+            }
+
+            printf("Node: ");
+            for (i = 0; i < node->key_count; i++)
+                printf("[%u:%d] ", (unsigned int)btree_key(node, i), (int)node->values[i]);
+            putchar('\n');
+        }
+
+        if (node->is_leaf || next[top] > node->key_count || top + 1 >= BTREE_MAX_HEIGHT)
+        {
+            if (top == 0)
+                break;
+            top--;
+            continue;
+        }
+
+        path[top + 1] = node->children[next[top]];
+        next[top]++;
+        top++;
+        next[top] = 0;
+    }
 }
 
-void btree_print(BTree *tree)
+unsigned int btree_free_nodes(BTree *tree, BTreeNode *node)
 {
-    if (!tree || !tree->root)
+    BTreeNode *path[BTREE_MAX_HEIGHT];
+    unsigned char next[BTREE_MAX_HEIGHT];
+    unsigned char top;
+    unsigned int keys;
+#if BTREE_SNAPSHOTS
+    unsigned char keep;
+#endif
+
+    if (!node)
+        return 0;
+
+    /* Post-order walk: a node is freed once all its children are gone */
+    keys = 0;
+    path[0] = node;
+    next[0] = 0;
+    top = 0;
+#if BTREE_SNAPSHOTS
+    keep = BTREE_MAX_HEIGHT; /* Level of the shared subtree being passed over */
+#endif
+
+    while (1)
     {
-        puts("Empty tree");
-        return;
+        node = path[top];
+
+#if BTREE_SNAPSHOTS
+        /* Another tree still uses a shared subtree: drop one reference and
+         * only count its keys
+         */
+        if (next[top] == 0 && keep == BTREE_MAX_HEIGHT && node->refs)
+        {
+            node->refs--;
+#if BTREE_ORDER_STATS
+            keys += btree_node_total(node);
+            if (top == 0)
+                break;
+            top--;
+            continue;
+#else
+            keep = top;
+#endif
+        }
+#endif
+
+        if (node->is_leaf || next[top] > node->key_count || top + 1 >= BTREE_MAX_HEIGHT)
+        {
+            keys += node->key_count;
+#if BTREE_SNAPSHOTS
+            if (keep == top)
+                keep = BTREE_MAX_HEIGHT;
+            else if (keep == BTREE_MAX_HEIGHT)
+                btree_node_free(tree, node);
+#else
+            btree_node_free(tree, node);
+#endif
+            if (top == 0)
+                break;
+            top--;
+            continue;
+        }
+
+        path[top + 1] = node->children[next[top]];
+        next[top]++;
+
+        /* Partially built subtrees may have missing children */
+        if (path[top + 1])
+        {
+            top++;
+            next[top] = 0;
+        }
     }
 
-    puts("B-tree structure:");
-    btree_print_node(tree->root, 0);
+    return keys;
 }
 
-static void btree_free_node(BTreeNode *node)
+unsigned char btree_clear(BTree *tree)
 {
-    unsigned char i;
+    BTreePool *pool;
 
-    if (!node)
-        return;
+    if (!tree)
+        return 0;
 
-    if (!node->is_leaf)
-        for (i = 0; i <= node->key_count; i++)
-            btree_free_node(node->children[i]);
+    if (tree->pool)
+    {
+        /* Every node lives in the pool block: rewind the bump pointer and
+         * forget the free lists instead of releasing nodes one by one
+         */
+        pool = tree->pool;
+        pool->carved = 0;
+        pool->free_leaves = NULL;
+        pool->free_nodes = NULL;
+        pool->free_count = 0;
+        pool->used = 0;
+        pool->live_nodes = 0;
+    }
+    else
+        btree_free_nodes(tree, tree->root);
+
+    tree->size = 0;
+    btree_finger_drop(tree);
+#if BTREE_FILTER
+    if (tree->filter)
+    {
+        memset(tree->filter, 0, tree->filter_mask / 8 + 1);
+        tree->filter_stale = 0;
+    }
+#endif
+    tree->root = btree_node_create(tree, 1);
 
-    free(node);
+    return tree->root != NULL;
 }
 
 void btree_free(BTree *tree)
@@ -507,6 +1402,17 @@ void btree_free(BTree *tree)
     if (!tree)
         return;
 
-    btree_free_node(tree->root);
+    if (tree->pool)
+    {
+        /* Every node lives in the pool block, no need to walk the tree */
+        free(pool_memory(tree->pool));
+        free(tree->pool);
+    }
+    else
+        btree_free_nodes(tree, tree->root);
+
+#if BTREE_FILTER
+    free(tree->filter);
+#endif
     free(tree);
 }
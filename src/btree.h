@@ -1,53 +1,543 @@
-#ifndef BTREE_H
-#define BTREE_H
-
 /* B-tree implementation for RP6502
- * Default order is 3 (max 2 keys per node, max 3 children)
+ * Default order is 10 (max 9 keys per node, max 10 children)
  * Parameterize the maximum number of children with BTREE_MAX_CHILDREN.
  * Suitable for 256-byte stack limit and 16-bit int.
+ *
+ * Specialised trees with other key/value types are declared by defining
+ * BTREE_PREFIX (see btree_spec.h) before including this header again, so
+ * the guard below only applies to the default btree_* tree.
  */
+#ifdef BTREE_PREFIX
+#ifndef BTREE_SPEC_BODY
+#define BTREE_SPEC_BODY
+#define BTREE_BODY
+#include "btree_spec.h"
+#endif
+#elif !defined(BTREE_H)
+#define BTREE_H
+#define BTREE_BODY
+#endif
+
+#ifdef BTREE_BODY
+#undef BTREE_BODY
 
 #ifndef BTREE_MAX_CHILDREN
 #define BTREE_MAX_CHILDREN 10
 #endif
 
-#if (BTREE_MAX_CHILDREN < 3)
-#error "BTREE_MAX_CHILDREN must be at least 3"
+/* Top-down deletion needs a merged node to hold two non-empty siblings
+ * plus their separator, which order 3 cannot do.
+ */
+#if (BTREE_MAX_CHILDREN < 4)
+#error "BTREE_MAX_CHILDREN must be at least 4"
 #endif
 
 #define BTREE_MAX_KEYS (BTREE_MAX_CHILDREN - 1)
-#define BTREE_MIN_CHILDREN ((BTREE_MAX_CHILDREN + 1) / 2)
-#define BTREE_MIN_KEYS (BTREE_MIN_CHILDREN - 1)
+/* Two minimal siblings plus their separator must fit in one node when merged */
+#define BTREE_MIN_KEYS ((BTREE_MAX_KEYS - 1) / 2)
+#define BTREE_MIN_CHILDREN (BTREE_MIN_KEYS + 1)
 #define BTREE_SPLIT_INDEX (BTREE_MAX_KEYS / 2)
 
+/* Node split policies, see btree_set_split_policy() */
+#define BTREE_SPLIT_MIDDLE 0
+#define BTREE_SPLIT_APPEND 1
+
+/* An append split of a leaf promotes its last key and leaves the new leaf
+ * to the appended key alone. Internal nodes keep all but two keys and move
+ * one, so the new node is never empty; small orders have no room for this
+ * and split internal nodes in the middle.
+ */
+#if (BTREE_MAX_KEYS - 2 > BTREE_SPLIT_INDEX)
+#define BTREE_APPEND_SPLIT_INDEX (BTREE_MAX_KEYS - 2)
+#else
+#define BTREE_APPEND_SPLIT_INDEX BTREE_SPLIT_INDEX
+#endif
+
+/* In-node key search strategy. Linear wins on small nodes, binary search
+ * on large ones; the unrolled scan sits in between. Chosen from the node
+ * size unless BTREE_SEARCH is defined.
+ */
+#define BTREE_SEARCH_LINEAR 0
+#define BTREE_SEARCH_BINARY 1
+#define BTREE_SEARCH_UNROLLED 2
+
+#ifndef BTREE_SEARCH
+#if (BTREE_MAX_KEYS <= 8)
+#define BTREE_SEARCH BTREE_SEARCH_LINEAR
+#elif (BTREE_MAX_KEYS <= 16)
+#define BTREE_SEARCH BTREE_SEARCH_UNROLLED
+#else
+#define BTREE_SEARCH BTREE_SEARCH_BINARY
+#endif
+#endif
+
+/* Traversals use an explicit path array of this many levels instead of
+ * recursion. Every non-root node has at least two children, so 16 levels
+ * cover any set of 16-bit keys.
+ */
+#ifndef BTREE_MAX_HEIGHT
+#define BTREE_MAX_HEIGHT 16
+#endif
+
+/* Internal nodes keep the number of keys below each child, which gives
+ * btree_select() and btree_rank() in O(log n). Define BTREE_ORDER_STATS
+ * as 0 to drop the counts and those two calls.
+ */
+#ifndef BTREE_ORDER_STATS
+#define BTREE_ORDER_STATS 1
+#endif
+
+/* Byte-plane key layout. Keys are stored as a plane of low bytes and a
+ * plane of high bytes, so the in-node scan compares single bytes with an
+ * 8-bit index, and pool blocks start on a 256-byte page with no node
+ * straddling a page. Keys must then be unsigned and at most 16 bits wide,
+ * in their natural order.
+ */
+#ifndef BTREE_BYTE_PLANES
+#define BTREE_BYTE_PLANES 0
+#endif
+
+/* Copy-on-write snapshots. Nodes carry a reference count so that
+ * btree_snapshot() can share them between trees; writes copy shared nodes
+ * on their path first. Define BTREE_SNAPSHOTS as 0 to drop the count byte
+ * and btree_snapshot().
+ */
+#ifndef BTREE_SNAPSHOTS
+#define BTREE_SNAPSHOTS 1
+#endif
+
+/* Negative-lookup filter in front of btree_get(), see btree_set_filter().
+ * Define BTREE_FILTER as 0 to drop its fields, its calls and
+ * btree_filter.c.
+ */
+#ifndef BTREE_FILTER
+#define BTREE_FILTER 1
+#endif
+
+/* Key and value types. Keys are compared with BTREE_KEY_LESS and
+ * BTREE_KEY_EQ; btree_get() returns BTREE_VALUE_NONE for a missing key.
+ */
+#ifndef BTREE_KEY_T
+#define BTREE_KEY_T unsigned int
+#endif
+
+#ifndef BTREE_VALUE_T
+#define BTREE_VALUE_T void *
+#endif
+
+#ifndef BTREE_VALUE_NONE
+#define BTREE_VALUE_NONE ((BTREE_VALUE_T)0)
+#endif
+
+#ifndef BTREE_KEY_LESS
+#define BTREE_KEY_LESS(a, b) ((a) < (b))
+#endif
+
+#ifndef BTREE_KEY_EQ
+#define BTREE_KEY_EQ(a, b) ((a) == (b))
+#endif
+
+/* 16 bits of a key for the negative-lookup filter, see btree_set_filter() */
+#ifndef BTREE_KEY_HASH
+#define BTREE_KEY_HASH(key) ((unsigned int)(key))
+#endif
+
+typedef BTREE_KEY_T BTreeKey;
+typedef BTREE_VALUE_T BTreeValue;
+
+/* Leaf nodes are allocated with this smaller layout, which omits the
+ * children array. It must stay a prefix of BTreeNode so both can be
+ * handled through a BTreeNode pointer; children is only touched when
+ * is_leaf is 0.
+ */
+typedef struct BTreeLeaf
+{
+    unsigned char key_count;   /* Number of keys in this node */
+    unsigned char is_leaf;     /* 1 if leaf, 0 if internal node */
+#if BTREE_BYTE_PLANES
+    unsigned char key_lo[BTREE_MAX_KEYS];   /* Key storage, low bytes */
+    unsigned char key_hi[BTREE_MAX_KEYS];   /* Key storage, high bytes */
+#else
+    BTreeKey keys[BTREE_MAX_KEYS];          /* Key storage */
+#endif
+    BTreeValue values[BTREE_MAX_KEYS];      /* Value storage */
+#if BTREE_SNAPSHOTS
+    unsigned char refs;        /* Parents or trees beyond the first sharing this node */
+#endif
+} BTreeLeaf;
+
 typedef struct BTreeNode
 {
-    unsigned int keys[BTREE_MAX_KEYS];      /* Key storage */
-    void *values[BTREE_MAX_KEYS];           /* Generic values - can store any pointer */
-    struct BTreeNode *children[BTREE_MAX_CHILDREN]; /* Child pointers */
     unsigned char key_count;   /* Number of keys in this node */
     unsigned char is_leaf;     /* 1 if leaf, 0 if internal node */
+#if BTREE_BYTE_PLANES
+    unsigned char key_lo[BTREE_MAX_KEYS];   /* Key storage, low bytes */
+    unsigned char key_hi[BTREE_MAX_KEYS];   /* Key storage, high bytes */
+#else
+    BTreeKey keys[BTREE_MAX_KEYS];          /* Key storage */
+#endif
+    BTreeValue values[BTREE_MAX_KEYS];      /* Value storage */
+#if BTREE_SNAPSHOTS
+    unsigned char refs;        /* Parents or trees beyond the first sharing this node */
+#endif
+    struct BTreeNode *children[BTREE_MAX_CHILDREN]; /* Child pointers, internal nodes only */
+#if BTREE_ORDER_STATS
+    unsigned int counts[BTREE_MAX_CHILDREN]; /* Keys in each child's subtree */
+#endif
 } BTreeNode;
 
+#define BTREE_LEAF_SIZE (sizeof(BTreeLeaf))
+#define BTREE_NODE_SIZE (sizeof(BTreeNode))
+
+/* Optional fixed-capacity node pool.
+ * Nodes are carved from one preallocated block and recycled through an
+ * O(1) free list, so split/merge churn never touches the cc65 heap.
+ * Define BTREE_USE_POOL to make btree_create() use a BTREE_POOL_BYTES pool.
+ */
+#ifndef BTREE_POOL_BYTES
+#define BTREE_POOL_BYTES 8192
+#endif
+
+typedef struct BTreePool
+{
+    unsigned char *block;      /* Preallocated node storage */
+#if BTREE_BYTE_PLANES
+    unsigned char *memory;     /* Allocation holding block, which starts on a page */
+#endif
+    unsigned int capacity;     /* Size of block in bytes */
+    unsigned int carved;       /* Bytes handed out so far by the bump pointer */
+    BTreeNode *free_leaves;    /* Released leaves, linked through their first bytes */
+    BTreeNode *free_nodes;     /* Released internal nodes */
+    unsigned int free_count;   /* Nodes waiting on either free list */
+    unsigned int used;         /* Bytes occupied by live nodes */
+    unsigned int live_nodes;   /* Nodes currently in use */
+    unsigned int peak_nodes;   /* High-water mark of live_nodes */
+    unsigned int allocs;       /* Successful allocations */
+    unsigned int frees;        /* Nodes returned to the free list */
+    unsigned int failures;     /* Allocations refused because the pool was full */
+} BTreePool;
+
+typedef struct
+{
+    unsigned int capacity;     /* Pool size in bytes */
+    unsigned int used;         /* Bytes occupied by live nodes */
+    unsigned int live_nodes;
+    unsigned int peak_nodes;
+    unsigned int free_nodes;   /* Nodes waiting on the free list */
+    unsigned int allocs;
+    unsigned int frees;
+    unsigned int failures;
+} BTreePoolStats;
+
+#ifndef BTREE_PREFIX
+/* Optional value arena.
+ * btree_put() copies values of up to BTREE_ARENA_MAX_VALUE bytes into
+ * chunks of 8, 16, 24, 32, 48, 64, 96 or 128 bytes (2 of them a
+ * class/length header), carved from BTREE_ARENA_SLAB_BYTES slabs dedicated
+ * to one size class. Released chunks go on a per-class free list.
+ */
+#define BTREE_ARENA_CLASSES 8
+#define BTREE_ARENA_MIN_CHUNK 8
+#define BTREE_ARENA_MAX_CHUNK 128
+#define BTREE_ARENA_MAX_VALUE (BTREE_ARENA_MAX_CHUNK - 2)
+
+#ifndef BTREE_ARENA_SLAB_BYTES
+#define BTREE_ARENA_SLAB_BYTES 512
+#endif
+
+#if (BTREE_ARENA_SLAB_BYTES < BTREE_ARENA_MAX_CHUNK || BTREE_ARENA_SLAB_BYTES / BTREE_ARENA_MIN_CHUNK > 255)
+#error "BTREE_ARENA_SLAB_BYTES must be 128..2040"
+#endif
+
+typedef struct BTreeArena
+{
+    unsigned char *slabs;      /* Every slab, linked through its first bytes */
+    unsigned char *free_chunks[BTREE_ARENA_CLASSES]; /* Released chunks per class */
+    unsigned char *carve[BTREE_ARENA_CLASSES];       /* Next fresh chunk per class */
+    unsigned char carve_left[BTREE_ARENA_CLASSES];   /* Fresh chunks left in that slab */
+    unsigned int slab_count;
+    unsigned int values;       /* Live values */
+    unsigned int value_bytes;  /* Bytes stored in live values */
+    unsigned int chunk_bytes;  /* Bytes of the chunks holding them */
+    unsigned int failures;     /* Allocations refused for lack of memory */
+} BTreeArena;
+
+typedef struct
+{
+    unsigned int slabs;
+    unsigned int slab_bytes;   /* Heap taken by slabs */
+    unsigned int values;
+    unsigned int value_bytes;
+    unsigned int chunk_bytes;
+    unsigned int failures;
+} BTreeArenaStats;
+#endif
+
+/* Finger flags: enabled, and which bounds of the finger leaf are set.
+ * The leftmost and rightmost leaves have no lower/upper bound.
+ */
+#define BTREE_FINGER_ON 0x01
+#define BTREE_FINGER_LO 0x02
+#define BTREE_FINGER_HI 0x04
+
+typedef struct
+{
+    unsigned int hits;         /* Operations served from the finger leaf */
+    unsigned int misses;       /* Operations that descended from the root */
+} BTreeFingerStats;
+
+#if BTREE_FILTER
+typedef struct
+{
+    unsigned int bytes;        /* Filter size, 0 when off */
+    unsigned int checks;       /* Gets that consulted the filter */
+    unsigned int rejects;      /* Gets the filter answered as misses */
+    unsigned int rebuilds;     /* Rebuilds after deletes */
+} BTreeFilterStats;
+#endif
+
 typedef struct
 {
     BTreeNode *root;
+    BTreePool *pool;           /* NULL when nodes come from malloc() */
+    unsigned int size;         /* Keys in the tree */
+    unsigned char split_policy; /* BTREE_SPLIT_MIDDLE or BTREE_SPLIT_APPEND */
+    BTreeNode *finger;         /* Leaf of the last descent, NULL when unset */
+    BTreeKey finger_lo;        /* The finger leaf holds every key strictly */
+    BTreeKey finger_hi;        /* between finger_lo and finger_hi */
+    unsigned char finger_flags; /* BTREE_FINGER_* */
+    unsigned int finger_hits;
+    unsigned int finger_misses;
+#if BTREE_ORDER_STATS
+    unsigned int *finger_counts[BTREE_MAX_HEIGHT]; /* Counts leading to the finger leaf */
+    unsigned char finger_depth; /* Entries in finger_counts */
+#endif
+#if BTREE_FILTER
+    unsigned char *filter;     /* Negative-lookup bit filter, NULL when off */
+    unsigned int filter_mask;  /* Bits in the filter - 1 */
+    unsigned char filter_shift; /* 16 - log2 of the bits in the filter */
+    unsigned int filter_stale; /* Deletes since the filter was built */
+    unsigned int filter_checks;
+    unsigned int filter_rejects;
+    unsigned int filter_rebuilds;
+#endif
 } BTree;
 
+/* Ordered cursor. Holds the root-to-key path so stepping never
+ * re-descends from the root. Any insert or delete invalidates it.
+ */
+typedef struct
+{
+    BTreeNode *path[BTREE_MAX_HEIGHT];  /* Nodes from the root down to the current key */
+    unsigned char index[BTREE_MAX_HEIGHT]; /* Child taken per level; key index at the last level */
+    unsigned char depth;       /* Levels in path, 0 when off either end */
+} BTreeCursor;
+
+/* Range visitor, return 0 to stop the scan */
+typedef unsigned char (*BTreeVisit)(BTreeKey key, BTreeValue value, void *ctx);
+
+/* Upsert callback: gets the key's value, BTREE_VALUE_NONE for a new key,
+ * and returns the value to store
+ */
+typedef BTreeValue (*BTreeUpsert)(BTreeKey key, BTreeValue value, void *ctx);
+
+/* Frozen index from btree_freeze(): keys and values in Eytzinger order,
+ * 1-based, entry k's children at 2k and 2k+1. It does not change when the
+ * tree does.
+ */
+#define BTREE_FROZEN_MAX 32767U
+
+typedef struct
+{
+    BTreeKey *keys;
+    BTreeValue *values;
+    unsigned int count;        /* Entries 1..count are used */
+} BTreeFrozen;
+
 /* Initialize a new B-tree */
 BTree *btree_create(void);
 
-/* Insert a key-value pair (value is a void pointer) */
-void btree_insert(BTree *tree, unsigned int key, void *value);
+/* Initialize a new B-tree whose nodes come from a pool of pool_bytes bytes */
+BTree *btree_create_pool(unsigned int pool_bytes);
+
+/* Copy pool statistics into stats, returns 0 if the tree is not pool-backed */
+unsigned char btree_pool_stats(BTree *tree, BTreePoolStats *stats);
+
+/* Choose how full nodes split. BTREE_SPLIT_APPEND packs the left node when
+ * a key lands past the rightmost key of the tree, so ascending inserts
+ * leave nearly full nodes behind; other inserts still split in the middle.
+ * Nodes on the right edge may then hold fewer than BTREE_MIN_KEYS keys.
+ * Returns 0 for an unknown policy.
+ */
+unsigned char btree_set_split_policy(BTree *tree, unsigned char policy);
+
+/* Remember the leaf reached by the last get, update or insert together
+ * with its key bounds, so a following operation on a key inside those
+ * bounds skips the descent from the root. Splits, merges and borrows drop
+ * the finger. Enabling resets the counters. Returns 0 if tree is NULL.
+ */
+unsigned char btree_set_finger(BTree *tree, unsigned char enable);
+
+/* Copy finger hit/miss counters into stats, returns 0 if the finger is off */
+unsigned char btree_finger_stats(BTree *tree, BTreeFingerStats *stats);
+
+#if BTREE_FILTER
+/* Put a Bloom-style filter of filter_bytes bytes (rounded down to a power
+ * of two, at most 8192; 0 turns it off) in front of btree_get. Every key
+ * sets two bits, and a get whose key finds either bit clear returns
+ * BTREE_VALUE_NONE without a descent. Deletes leave their bits behind;
+ * once more keys have been deleted than half the tree holds, the next get
+ * rebuilds the filter from the tree. Enabling builds it and resets the
+ * counters. Returns 0 if tree is NULL or the filter cannot be allocated.
+ */
+unsigned char btree_set_filter(BTree *tree, unsigned int filter_bytes);
 
-/* Search for a key, returns value pointer or NULL if not found */
-void *btree_get(BTree *tree, unsigned int key);
+/* Copy filter counters into stats, returns 0 if the filter is off */
+unsigned char btree_filter_stats(BTree *tree, BTreeFilterStats *stats);
+#endif
+
+/* Insert a key-value pair */
+void btree_insert(BTree *tree, BTreeKey key, BTreeValue value);
+
+/* Insert n key-value pairs as n btree_insert() calls would, the last of
+ * equal keys winning. The batch is visited in key order and keeps its
+ * path between keys, so keys that land in the same leaf share a descent.
+ * Unsorted batches take 4n bytes of heap to sort while they run.
+ */
+void btree_insert_many(BTree *tree, BTreeKey *keys, BTreeValue *values, unsigned int n);
+
+/* Build an empty tree from n strictly ascending keys (values may be NULL).
+ * Nodes are packed bottom-up to fill_percent of capacity (at least half).
+ * Returns 0 if the tree is not empty, the keys are unsorted, or memory runs out.
+ */
+unsigned char btree_bulk_load(BTree *tree, BTreeKey *keys, BTreeValue *values, unsigned int n, unsigned char fill_percent);
+
+/* Search for a key, returns its value or BTREE_VALUE_NONE if not found */
+BTreeValue btree_get(BTree *tree, BTreeKey key);
+
+/* Look up n keys with shared descents, as for btree_insert_many(). out[i]
+ * gets the value of keys[i] or BTREE_VALUE_NONE; returns how many were found.
+ */
+unsigned int btree_get_many(BTree *tree, BTreeKey *keys, unsigned int n, BTreeValue *out);
 
 /* Update an existing key's value */
-unsigned char btree_update(BTree *tree, unsigned int key, void *new_value);
+unsigned char btree_update(BTree *tree, BTreeKey key, BTreeValue new_value);
 
-/* Delete a key from the tree */
-unsigned char btree_delete(BTree *tree, unsigned int key);
+/* Pointer to key's value, for reading and changing it after one descent.
+ * With create set a missing key is inserted with BTREE_VALUE_NONE, as
+ * btree_insert() would; otherwise it gives NULL. NULL when out of memory.
+ * A present key is found without splitting or recounting anything; a
+ * missing one costs a second descent unless the finger is on and its
+ * leaf has room. The pointer is good until the next insert or delete on
+ * the tree.
+ */
+BTreeValue *btree_get_slot(BTree *tree, BTreeKey key, unsigned char create);
+
+/* Replace key's value with fn(key, value, ctx) through btree_get_slot(),
+ * inserting the key if it is missing. Returns 0 when out of memory.
+ */
+unsigned char btree_upsert(BTree *tree, BTreeKey key, BTreeUpsert fn, void *ctx);
+
+/* Delete a key from the tree in one descent, returns 1 if it was present.
+ * Define BTREE_DEBUG_VERIFY to also check for the key before and after.
+ */
+unsigned char btree_delete(BTree *tree, BTreeKey key);
+
+/* Delete every key from lo to hi inclusive, returns how many there were.
+ * Subtrees inside the range are released whole and the tree is
+ * rebalanced once, along the two paths to the ends of the range.
+ */
+unsigned int btree_delete_range(BTree *tree, BTreeKey lo, BTreeKey hi);
+
+/* Position the cursor on the first key >= key, returns 0 if there is none */
+unsigned char btree_cursor_seek(BTreeCursor *cursor, BTree *tree, BTreeKey key);
+
+/* Step to the next/previous key in order, returns 0 when running off the end */
+unsigned char btree_cursor_next(BTreeCursor *cursor);
+unsigned char btree_cursor_prev(BTreeCursor *cursor);
+
+/* Key and value at the cursor, which must be positioned */
+BTreeKey btree_cursor_key(BTreeCursor *cursor);
+BTreeValue btree_cursor_value(BTreeCursor *cursor);
+
+/* Visit keys lo..hi (inclusive) in order, returns the number visited */
+unsigned int btree_range(BTree *tree, BTreeKey lo, BTreeKey hi, BTreeVisit visit, void *ctx);
+
+/* Number of keys in the tree */
+unsigned int btree_size(BTree *tree);
+
+/* Copy the tree into a read-only index for lookups with no pointer
+ * chasing. NULL when out of memory or past BTREE_FROZEN_MAX keys.
+ */
+BTreeFrozen *btree_freeze(BTree *tree);
+
+/* Search the frozen index, returns the value or BTREE_VALUE_NONE */
+BTreeValue btree_frozen_get(BTreeFrozen *frozen, BTreeKey key);
+
+/* Visit keys lo..hi (inclusive) of the frozen index in order, returns the
+ * number visited
+ */
+unsigned int btree_frozen_range(BTreeFrozen *frozen, BTreeKey lo, BTreeKey hi, BTreeVisit visit, void *ctx);
+
+/* Number of keys in the frozen index */
+unsigned int btree_frozen_size(BTreeFrozen *frozen);
+
+/* Free a frozen index */
+void btree_frozen_free(BTreeFrozen *frozen);
+
+#if BTREE_SNAPSHOTS
+/* Take a snapshot: a second tree sharing every node with tree, in O(1).
+ * Either tree may then change; a write copies only the shared nodes on
+ * its path, so the other keeps seeing the keys it had. Release it with
+ * btree_free(), which frees only nodes no other tree still uses. Values
+ * are shared, not copied. NULL for pool-backed trees, when out of memory
+ * or when 255 snapshots of the root are already alive.
+ */
+BTree *btree_snapshot(BTree *tree);
+#endif
+
+#if BTREE_ORDER_STATS
+/* Store the k-th smallest key (from 0), returns 0 if k >= btree_size() */
+unsigned char btree_select(BTree *tree, unsigned int k, BTreeKey *key);
+
+/* Number of keys smaller than key, whether or not key is present */
+unsigned int btree_rank(BTree *tree, BTreeKey key);
+#endif
+
+#ifndef BTREE_PREFIX
+/* Create an empty value arena, NULL when out of memory */
+BTreeArena *btree_arena_create(void);
+
+/* Release every slab. Trees still pointing into the arena must not be used. */
+void btree_arena_destroy(BTreeArena *arena);
+
+/* Copy len bytes of data into the arena as the value of key. An existing
+ * arena value is overwritten in place when the new one fits its chunk and
+ * moved otherwise. Returns 0 if len exceeds BTREE_ARENA_MAX_VALUE or
+ * memory runs out. The old value is taken to be this arena's, so once a
+ * key is put it must only be written through btree_put()/btree_put_slot()
+ * and removed with btree_drop(); a key holding a btree_insert() value must
+ * be deleted before it is put. BTREE_DEBUG_VERIFY checks the old value
+ * and returns 0 when it is not an arena chunk.
+ */
+unsigned char btree_put(BTree *tree, BTreeArena *arena, unsigned int key, const void *data, unsigned char len);
+
+/* btree_put() through a slot from btree_get_slot(), so a key already found
+ * is not searched for again. The slot must hold BTREE_VALUE_NONE or a
+ * value of this arena. Returns 0 and leaves the slot alone if len exceeds
+ * BTREE_ARENA_MAX_VALUE or memory runs out.
+ */
+unsigned char btree_put_slot(BTreeArena *arena, BTreeValue *slot, const void *data, unsigned char len);
+
+/* Delete key and return its value's chunk to the arena, returns 1 if it was present */
+unsigned char btree_drop(BTree *tree, BTreeArena *arena, unsigned int key);
+
+/* Length of a value stored by btree_put() */
+unsigned char btree_arena_len(const void *value);
+
+/* Copy arena statistics into stats */
+unsigned char btree_arena_stats(BTreeArena *arena, BTreeArenaStats *stats);
+#endif
 
 /* Print tree structure (for debugging) */
 void btree_print(BTree *tree);
@@ -55,6 +545,19 @@ void btree_print(BTree *tree);
 /* Count total nodes in the tree */
 unsigned int btree_node_count(BTree *tree);
 
+/* Count leaf nodes in the tree */
+unsigned int btree_leaf_count(BTree *tree);
+
+/* Bytes occupied by the tree's nodes (compact leaves, full internal nodes) */
+unsigned int btree_memory_usage(BTree *tree);
+
+/* Remove every key but keep the tree, its pool, split policy and finger
+ * setting for reuse. A pool-backed tree is emptied in constant time by
+ * rewinding its pool; a heap tree frees its nodes one by one. Returns 0
+ * if tree is NULL or the new empty root cannot be allocated.
+ */
+unsigned char btree_clear(BTree *tree);
+
 /* Free all nodes in the tree */
 void btree_free(BTree *tree);
 
@@ -0,0 +1,240 @@
+#include "btree_int.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Value arena. A chunk starts with its size class and the stored length;
+ * the tree holds a pointer just past that header, so btree_get() returns
+ * the bytes directly.
+ */
+
+#define CHUNK_HEADER 2
+
+/* Half steps between powers of two keep the slack under a third */
+static const unsigned char chunk_sizes[BTREE_ARENA_CLASSES] = {
+    BTREE_ARENA_MIN_CHUNK, 16, 24, 32, 48, 64, 96, BTREE_ARENA_MAX_CHUNK
+};
+
+#define chunk_size(c) ((unsigned int)chunk_sizes[c])
+
+/* Slabs and released chunks are linked through their first bytes */
+typedef struct BTreeArenaLink
+{
+    unsigned char *next;
+} BTreeArenaLink;
+
+BTreeArena *btree_arena_create(void)
+{
+    BTreeArena *arena;
+    unsigned char c;
+
+    arena = (BTreeArena *)malloc(sizeof(BTreeArena));
+    if (!arena)
+        return NULL;
+
+    arena->slabs = NULL;
+    for (c = 0; c < BTREE_ARENA_CLASSES; c++)
+    {
+        arena->free_chunks[c] = NULL;
+        arena->carve[c] = NULL;
+        arena->carve_left[c] = 0;
+    }
+    arena->slab_count = 0;
+    arena->values = 0;
+    arena->value_bytes = 0;
+    arena->chunk_bytes = 0;
+    arena->failures = 0;
+
+    return arena;
+}
+
+void btree_arena_destroy(BTreeArena *arena)
+{
+    unsigned char *slab;
+
+    if (!arena)
+        return;
+
+    while (arena->slabs)
+    {
+        slab = arena->slabs;
+        arena->slabs = ((BTreeArenaLink *)slab)->next;
+        free(slab);
+    }
+    free(arena);
+}
+
+/* Smallest class whose chunks hold len bytes after the header */
+static unsigned char arena_class(unsigned char len)
+{
+    unsigned char c;
+
+    c = 0;
+    while (chunk_size(c) < (unsigned int)len + CHUNK_HEADER)
+        c++;
+    return c;
+}
+
+/* Value pointer of a fresh chunk of class c, NULL when out of memory */
+static unsigned char *arena_alloc(BTreeArena *arena, unsigned char c, unsigned char len)
+{
+    unsigned char *chunk;
+    unsigned char *slab;
+
+    if (arena->free_chunks[c])
+    {
+        chunk = arena->free_chunks[c];
+        arena->free_chunks[c] = ((BTreeArenaLink *)chunk)->next;
+    }
+    else
+    {
+        if (arena->carve_left[c] == 0)
+        {
+            slab = (unsigned char *)malloc(sizeof(BTreeArenaLink) + BTREE_ARENA_SLAB_BYTES);
+            if (!slab)
+            {
+                arena->failures++;
+                return NULL;
+            }
+            ((BTreeArenaLink *)slab)->next = arena->slabs;
+            arena->slabs = slab;
+            arena->slab_count++;
+            arena->carve[c] = slab + sizeof(BTreeArenaLink);
+            arena->carve_left[c] = (unsigned char)(BTREE_ARENA_SLAB_BYTES / chunk_size(c));
+        }
+        chunk = arena->carve[c];
+        arena->carve[c] += chunk_size(c);
+        arena->carve_left[c]--;
+    }
+
+    chunk[0] = c;
+    chunk[1] = len;
+    arena->values++;
+    arena->value_bytes += len;
+    arena->chunk_bytes += chunk_size(c);
+    return chunk + CHUNK_HEADER;
+}
+
+static void arena_release(BTreeArena *arena, unsigned char *value)
+{
+    unsigned char *chunk;
+    unsigned char c;
+
+    chunk = value - CHUNK_HEADER;
+    c = chunk[0];
+    arena->values--;
+    arena->value_bytes -= chunk[1];
+    arena->chunk_bytes -= chunk_size(c);
+
+    ((BTreeArenaLink *)chunk)->next = arena->free_chunks[c];
+    arena->free_chunks[c] = chunk;
+}
+
+unsigned char btree_arena_len(const void *value)
+{
+    return ((const unsigned char *)value)[-1];
+}
+
+#ifdef BTREE_DEBUG_VERIFY
+/* Returns 1 if value points just past the header of a chunk in one of
+ * arena's slabs
+ */
+static unsigned char arena_owns(BTreeArena *arena, const unsigned char *value)
+{
+    unsigned char *slab;
+    const unsigned char *start;
+
+    for (slab = arena->slabs; slab; slab = ((BTreeArenaLink *)slab)->next)
+    {
+        start = slab + sizeof(BTreeArenaLink);
+        if (value >= start + CHUNK_HEADER && value < start + BTREE_ARENA_SLAB_BYTES)
+            return value[-2] < BTREE_ARENA_CLASSES;
+    }
+    return 0;
+}
+#endif
+
+unsigned char btree_put_slot(BTreeArena *arena, BTreeValue *slot, const void *data, unsigned char len)
+{
+    unsigned char *value;
+    unsigned char *old;
+
+    if (!arena || !slot || len > BTREE_ARENA_MAX_VALUE)
+        return 0;
+
+    /* The chunk header in front of the old value says where it may be
+     * rewritten, so the slot must hold nothing or an arena value
+     */
+    old = (unsigned char *)*slot;
+#ifdef BTREE_DEBUG_VERIFY
+    if (old && !arena_owns(arena, old))
+        return 0; /* Value from btree_insert() or another arena */
+#endif
+    if (old && chunk_size(old[-2]) >= (unsigned int)len + CHUNK_HEADER)
+    {
+        /* Fits the current chunk: overwrite in place */
+        arena->value_bytes = arena->value_bytes - old[-1] + len;
+        old[-1] = len;
+        memcpy(old, data, len);
+        return 1;
+    }
+
+    value = arena_alloc(arena, arena_class(len), len);
+    if (!value)
+        return 0;
+    memcpy(value, data, len);
+
+    *slot = value;
+    if (old)
+        arena_release(arena, old);
+    return 1;
+}
+
+unsigned char btree_put(BTree *tree, BTreeArena *arena, unsigned int key, const void *data, unsigned char len)
+{
+    BTreeValue *slot;
+
+    if (!tree || !arena || len > BTREE_ARENA_MAX_VALUE)
+        return 0;
+
+    /* Finds the key or inserts it with no value yet */
+    slot = btree_get_slot(tree, key, 1);
+    if (!slot)
+        return 0;
+
+    if (!btree_put_slot(arena, slot, data, len))
+    {
+        if (!*slot)
+            btree_delete(tree, key);
+        return 0;
+    }
+    return 1;
+}
+
+unsigned char btree_drop(BTree *tree, BTreeArena *arena, unsigned int key)
+{
+    unsigned char *value;
+
+    if (!tree || !arena)
+        return 0;
+
+    value = (unsigned char *)btree_get(tree, key);
+    if (!value || !btree_delete(tree, key))
+        return 0;
+
+    arena_release(arena, value);
+    return 1;
+}
+
+unsigned char btree_arena_stats(BTreeArena *arena, BTreeArenaStats *stats)
+{
+    if (!arena || !stats)
+        return 0;
+
+    stats->slabs = arena->slab_count;
+    stats->slab_bytes = (unsigned int)(arena->slab_count * (sizeof(BTreeArenaLink) + BTREE_ARENA_SLAB_BYTES));
+    stats->values = arena->values;
+    stats->value_bytes = arena->value_bytes;
+    stats->chunk_bytes = arena->chunk_bytes;
+    stats->failures = arena->failures;
+    return 1;
+}
@@ -0,0 +1,240 @@
+#include "btree_int.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Batch get and insert. The keys are visited in ascending order and the
+ * root-to-leaf path of the previous key is kept, with the upper bound of
+ * every subtree on it. A key is never below the subtree its predecessor
+ * ended in, so it climbs only while it is past an upper bound and
+ * descends from there: keys that share a leaf cost one search of that
+ * leaf each.
+ */
+
+typedef struct
+{
+    unsigned char depth;                   /* Nodes on the path, 0 to start at the root */
+    BTreeNode *node[BTREE_MAX_HEIGHT];
+    unsigned char index[BTREE_MAX_HEIGHT]; /* Child of node[d - 1] that node[d] is */
+    unsigned char bounded[BTREE_MAX_HEIGHT]; /* Set when hi[d] applies */
+    BTreeKey hi[BTREE_MAX_HEIGHT];         /* Keys below node[d] are < hi[d] */
+} BatchPath;
+
+/* Indexes of the keys in ascending order, NULL when the keys are already
+ * ascending. *sorted is cleared when the order does not fit in memory;
+ * the batch then runs in the order given, one full descent per key.
+ */
+static unsigned int *batch_order(BTreeKey *keys, unsigned int n, unsigned char *sorted)
+{
+    unsigned int *order;
+    unsigned int *from;
+    unsigned int *to;
+    unsigned int *swap;
+    unsigned int width;
+    unsigned int lo;
+    unsigned int mid;
+    unsigned int hi;
+    unsigned int i;
+    unsigned int j;
+    unsigned int k;
+
+    *sorted = 1;
+    for (i = 1; i < n && !BTREE_KEY_LESS(keys[i], keys[i - 1]); i++)
+        ;
+    if (i >= n)
+        return NULL;
+
+    order = (unsigned int *)malloc(2 * n * sizeof(unsigned int));
+    if (!order)
+    {
+        *sorted = 0;
+        return NULL;
+    }
+    for (i = 0; i < n; i++)
+        order[i] = i;
+
+    /* Bottom-up merge sort between the two halves of the block. It is
+     * stable, so equal keys keep their batch order and the last insert of
+     * a key wins as it would one call at a time.
+     */
+    from = order;
+    to = order + n;
+    for (width = 1; width < n; width *= 2)
+    {
+        for (lo = 0; lo < n; lo = hi)
+        {
+            mid = n - lo > width ? lo + width : n;
+            hi = n - mid > width ? mid + width : n;
+            i = lo;
+            j = mid;
+            k = lo;
+            while (i < mid && j < hi)
+                to[k++] = BTREE_KEY_LESS(keys[from[j]], keys[from[i]]) ? from[j++] : from[i++];
+            while (i < mid)
+                to[k++] = from[i++];
+            while (j < hi)
+                to[k++] = from[j++];
+        }
+        swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != order)
+        memcpy(order, from, n * sizeof(unsigned int));
+    return order;
+}
+
+/* Node holding key, or the leaf where the search for it ends, reached from
+ * the lowest node on the path whose subtree can hold key, which must not
+ * be below the previous one. The index of the first key >= key goes to
+ * *index. With own set the shared nodes on the way down are copied; NULL
+ * when out of memory.
+ */
+static BTreeNode *batch_seek(BTree *tree, BatchPath *path, BTreeKey key, unsigned char *index, unsigned char own)
+{
+    BTreeNode *node;
+    unsigned char d;
+    unsigned char i;
+
+    /* Climb out of every subtree key is past the end of */
+    d = path->depth;
+    while (d > 1 && path->bounded[d - 1] && !BTREE_KEY_LESS(key, path->hi[d - 1]))
+        d--;
+
+    if (d == 0)
+    {
+        node = own ? node_own(tree, &tree->root) : tree->root;
+        if (!node)
+            return NULL;
+        path->node[0] = node;
+        path->bounded[0] = 0;
+        d = 1;
+    }
+
+    node = path->node[d - 1];
+    while (1)
+    {
+        i = node_find(node, key);
+        if (node->is_leaf || (i < node->key_count && BTREE_KEY_EQ(key, btree_key(node, i))))
+            break;
+
+        /* The last child shares its parent's bound */
+        path->index[d] = i;
+        path->bounded[d] = path->bounded[d - 1];
+        path->hi[d] = path->hi[d - 1];
+        if (i < node->key_count)
+        {
+            path->hi[d] = btree_key(node, i);
+            path->bounded[d] = 1;
+        }
+
+        node = own ? node_own(tree, &node->children[i]) : node->children[i];
+        if (!node)
+            break;
+        path->node[d] = node;
+        d++;
+    }
+
+    path->depth = d;
+    *index = i;
+    return node;
+}
+
+unsigned int btree_get_many(BTree *tree, BTreeKey *keys, unsigned int n, BTreeValue *out)
+{
+    BatchPath path;
+    BTreeNode *node;
+    unsigned int *order;
+    unsigned int found;
+    unsigned int j;
+    unsigned int k;
+    unsigned char i;
+    unsigned char sorted;
+
+    if (!tree || !tree->root || !keys || !out)
+        return 0;
+
+    order = batch_order(keys, n, &sorted);
+    path.depth = 0;
+    found = 0;
+
+    for (j = 0; j < n; j++)
+    {
+        k = order ? order[j] : j;
+        out[k] = BTREE_VALUE_NONE;
+        if (!sorted)
+            path.depth = 0;
+
+#if BTREE_FILTER
+        if (tree->filter && !btree_filter_test(tree, keys[k]))
+            continue;
+#endif
+
+        node = batch_seek(tree, &path, keys[k], &i, 0);
+        if (i < node->key_count && BTREE_KEY_EQ(keys[k], btree_key(node, i)))
+        {
+            out[k] = node->values[i];
+            found++;
+        }
+    }
+
+    free(order);
+    return found;
+}
+
+void btree_insert_many(BTree *tree, BTreeKey *keys, BTreeValue *values, unsigned int n)
+{
+    BatchPath path;
+    BTreeNode *node;
+    unsigned int *order;
+    unsigned int j;
+    unsigned int k;
+    unsigned char i;
+    unsigned char sorted;
+#if BTREE_ORDER_STATS
+    unsigned char d;
+#endif
+
+    if (!tree || !tree->root || !keys || !values)
+        return;
+
+    order = batch_order(keys, n, &sorted);
+    path.depth = 0;
+
+    for (j = 0; j < n; j++)
+    {
+        k = order ? order[j] : j;
+        if (!sorted)
+            path.depth = 0;
+
+        node = batch_seek(tree, &path, keys[k], &i, 1);
+        if (node && i < node->key_count && BTREE_KEY_EQ(keys[k], btree_key(node, i)))
+        {
+            node->values[i] = values[k];
+            continue;
+        }
+
+        /* A full leaf splits on a plain insert's way down, and the tree
+         * changes shape under the path
+         */
+        if (!node || node->key_count == BTREE_MAX_KEYS)
+        {
+            btree_insert(tree, keys[k], values[k]);
+            path.depth = 0;
+            continue;
+        }
+
+#if BTREE_FILTER
+        if (tree->filter)
+            btree_filter_add(tree, keys[k]);
+#endif
+        btree_leaf_insert(node, i, keys[k], values[k]);
+        tree->size++;
+#if BTREE_ORDER_STATS
+        for (d = 1; d < path.depth; d++)
+            path.node[d - 1]->counts[path.index[d]]++;
+#endif
+    }
+
+    free(order);
+}
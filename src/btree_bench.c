@@ -0,0 +1,1604 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "btree_int.h"
+#include "pbtree.h"
+#include "btree_u8.h"
+#include "hashidx.h"
+
+/* B-tree micro benchmarks for RP6502.
+ * Timing uses clock(), which ticks at CLOCKS_PER_SEC (100 Hz on the
+ * RP6502), so every measurement repeats enough work to span many ticks.
+ * Cycle figures assume the default 8 MHz PHI2.
+ */
+
+#define BENCH_PHI2_KHZ 8000UL
+#define BENCH_RUNS 10
+#define BENCH_MAX_ITEMS 1000
+
+/* Pool for BENCH_MAX_ITEMS keys with every node at its minimum fill: each
+ * leaf holds BTREE_MIN_KEYS keys plus a separator above it. Byte-plane
+ * pools keep nodes from straddling a page, so each page can lose up to
+ * a node.
+ */
+#define BENCH_POOL_LEAVES (BENCH_MAX_ITEMS / (BTREE_MIN_KEYS + 1) + 1)
+#define BENCH_POOL_NODES (BENCH_POOL_LEAVES * BTREE_LEAF_SIZE + \
+                          (BENCH_POOL_LEAVES / BTREE_MIN_KEYS + 1) * BTREE_NODE_SIZE)
+#if BTREE_BYTE_PLANES
+#define BENCH_POOL_BYTES (BENCH_POOL_NODES / (0x100 - BTREE_NODE_SIZE) * 0x100 + 0x100)
+#else
+#define BENCH_POOL_BYTES BENCH_POOL_NODES
+#endif
+
+static clock_t bench_started;
+
+static void bench_start(void)
+{
+    bench_started = clock();
+}
+
+/* Print elapsed time and estimated cycles per operation */
+static unsigned long bench_stop(const char *label, unsigned long ops)
+{
+    unsigned long ticks;
+    unsigned long cycles;
+
+    ticks = (unsigned long)(clock() - bench_started);
+    cycles = 0;
+    if (ops)
+        cycles = ticks * (BENCH_PHI2_KHZ * 1000UL / CLOCKS_PER_SEC) / ops;
+
+    printf("  %-26s %6lu ms %7lu cyc/op\n", label, ticks * 1000UL / CLOCKS_PER_SEC, cycles);
+    return cycles;
+}
+
+static BTree *bench_tree(unsigned char pooled)
+{
+    if (pooled)
+        return btree_create_pool(BENCH_POOL_BYTES);
+    return btree_create();
+}
+
+/* Set when a pool refused a node: the run did less work than a heap run */
+static unsigned char bench_pool_full(BTree *tree)
+{
+    BTreePoolStats stats;
+
+    return (unsigned char)(btree_pool_stats(tree, &stats) && stats.failures != 0);
+}
+
+/* bench_stop(), or a note in its place when the pool ran out */
+static void bench_stop_pool(const char *label, unsigned long ops, unsigned char full)
+{
+    if (full)
+        printf("  %-26s pool full, not timed\n", label);
+    else
+        bench_stop(label, ops);
+}
+
+/* Heap vs pool: the create/fill/delete/free cycle of the main.c stress loop */
+static void bench_alloc(void)
+{
+    BTree *tree;
+    BTreePoolStats stats;
+    unsigned char pooled;
+    unsigned char full;
+    unsigned int run;
+    unsigned int i;
+    unsigned long ops;
+
+    puts("Node allocation (heap vs pool):");
+
+    for (pooled = 0; pooled < 2; pooled++)
+    {
+        printf(" %s\n", pooled ? "pool" : "heap");
+
+        ops = 0;
+        full = 0;
+        bench_start();
+        for (run = 0; run < BENCH_RUNS; run++)
+        {
+            tree = bench_tree(pooled);
+            if (!tree)
+            {
+                puts("  create failed");
+                return;
+            }
+
+            for (i = 0; i < BENCH_MAX_ITEMS; i++)
+                btree_insert(tree, i, (void *)(i + 1));
+            ops += BENCH_MAX_ITEMS;
+
+            for (i = 0; i < BENCH_MAX_ITEMS; i += 2)
+                btree_delete(tree, i);
+
+            full |= bench_pool_full(tree);
+            if (pooled && run == BENCH_RUNS - 1 && btree_pool_stats(tree, &stats))
+                printf("  pool: %u/%u bytes, peak %u nodes, %u allocs, %u failed\n",
+                       stats.used, stats.capacity, stats.peak_nodes, stats.allocs, stats.failures);
+
+            btree_free(tree);
+        }
+        bench_stop_pool("insert+delete+free cycle", ops, full);
+
+        tree = bench_tree(pooled);
+        if (!tree)
+            return;
+        bench_start();
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_insert(tree, i, (void *)(i + 1));
+        bench_stop_pool("insert", BENCH_MAX_ITEMS, bench_pool_full(tree));
+        btree_free(tree);
+    }
+    putchar('\n');
+}
+
+/* The main.c run loop: a new tree per run, or one tree emptied between runs */
+static void bench_clear(void)
+{
+    BTree *tree;
+    unsigned char pooled;
+    unsigned char full;
+    unsigned int run;
+    unsigned int i;
+
+    puts("Tree reset (create/fill/free vs fill/clear, 1000 keys):");
+
+    for (pooled = 0; pooled < 2; pooled++)
+    {
+        printf(" %s\n", pooled ? "pool" : "heap");
+
+        full = 0;
+        bench_start();
+        for (run = 0; run < BENCH_RUNS; run++)
+        {
+            tree = bench_tree(pooled);
+            if (!tree)
+                return;
+            for (i = 0; i < BENCH_MAX_ITEMS; i++)
+                btree_insert(tree, i, (void *)(i + 1));
+            full |= bench_pool_full(tree);
+            btree_free(tree);
+        }
+        bench_stop_pool("create+fill+free (per run)", BENCH_RUNS, full);
+
+        tree = bench_tree(pooled);
+        if (!tree)
+            return;
+        full = 0;
+        bench_start();
+        for (run = 0; run < BENCH_RUNS; run++)
+        {
+            for (i = 0; i < BENCH_MAX_ITEMS; i++)
+                btree_insert(tree, i, (void *)(i + 1));
+            full |= bench_pool_full(tree);
+            btree_clear(tree);
+        }
+        bench_stop_pool("fill+clear (per run)", BENCH_RUNS, full);
+        btree_free(tree);
+    }
+    putchar('\n');
+}
+
+#if BTREE_FILTER
+#define BENCH_FILTER_PROBES 1000
+
+/* Gets of absent and present keys with no filter and with filters of a
+ * few sizes
+ */
+static void bench_filter(void)
+{
+    static unsigned int present[BENCH_MAX_ITEMS];
+    static unsigned int absent[BENCH_FILTER_PROBES];
+    static const unsigned int sizes[] = {0, 128, 256, 512};
+    BTree *tree;
+    BTreeFilterStats stats;
+    unsigned long per_mille;
+    unsigned int key;
+    unsigned int run;
+    unsigned int i;
+    unsigned char s;
+
+    puts("Negative-lookup filter (1000 random keys):");
+
+    tree = btree_create();
+    if (!tree)
+        return;
+    for (i = 0; i < BENCH_MAX_ITEMS; i++)
+    {
+        present[i] = (unsigned int)rand();
+        btree_insert(tree, present[i], (void *)(i + 1));
+    }
+
+    for (i = 0; i < BENCH_FILTER_PROBES; )
+    {
+        key = (unsigned int)rand();
+        if (!btree_get(tree, key))
+            absent[i++] = key;
+    }
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        if (!btree_set_filter(tree, sizes[s]))
+            break;
+        if (sizes[s])
+            printf(" %u-byte filter\n", sizes[s]);
+        else
+            puts(" no filter");
+
+        bench_start();
+        for (run = 0; run < BENCH_RUNS; run++)
+            for (i = 0; i < BENCH_FILTER_PROBES; i++)
+                btree_get(tree, absent[i]);
+        bench_stop("btree_get (absent key)", (unsigned long)BENCH_RUNS * BENCH_FILTER_PROBES);
+
+        if (btree_filter_stats(tree, &stats) && stats.checks)
+        {
+            per_mille = (unsigned long)(stats.checks - stats.rejects) * 1000UL / stats.checks;
+            printf("  false positives %lu.%lu%%\n", per_mille / 10, per_mille % 10);
+        }
+
+        bench_start();
+        for (run = 0; run < BENCH_RUNS; run++)
+            for (i = 0; i < BENCH_MAX_ITEMS; i++)
+                btree_get(tree, present[i]);
+        bench_stop("btree_get (present key)", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+    }
+
+    btree_free(tree);
+    putchar('\n');
+}
+#endif
+
+/* Gets on the live tree vs its frozen copy, 1000 random keys */
+static void bench_freeze(void)
+{
+    static unsigned int keys[BENCH_MAX_ITEMS];
+    BTree *tree;
+    BTreeFrozen *frozen;
+    unsigned int i;
+    unsigned int run;
+
+    puts("Frozen index (1000 random keys):");
+
+    tree = btree_create();
+    if (!tree)
+        return;
+    for (i = 0; i < BENCH_MAX_ITEMS; i++)
+    {
+        keys[i] = (unsigned int)rand();
+        btree_insert(tree, keys[i], (void *)(i + 1));
+    }
+
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+    {
+        frozen = btree_freeze(tree);
+        btree_frozen_free(frozen);
+    }
+    bench_stop("btree_freeze (per key)", (unsigned long)BENCH_RUNS * btree_size(tree));
+
+    frozen = btree_freeze(tree);
+    if (!frozen)
+    {
+        btree_free(tree);
+        return;
+    }
+
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_get(tree, keys[(unsigned int)rand() % BENCH_MAX_ITEMS]);
+    bench_stop("btree_get (random hit)", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_frozen_get(frozen, keys[(unsigned int)rand() % BENCH_MAX_ITEMS]);
+    bench_stop("btree_frozen_get (hit)", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_get(tree, (unsigned int)rand());
+    bench_stop("btree_get (random key)", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_frozen_get(frozen, (unsigned int)rand());
+    bench_stop("btree_frozen_get (random)", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    printf("  tree %u bytes, frozen %u bytes\n", btree_memory_usage(tree),
+           (unsigned int)((btree_frozen_size(frozen) + 1) * (sizeof(BTreeKey) + sizeof(BTreeValue))));
+
+    btree_frozen_free(frozen);
+    btree_free(tree);
+    putchar('\n');
+}
+
+#if BTREE_SNAPSHOTS
+#define BENCH_SNAPSHOTS 1000
+
+/* Snapshot cost, and writes with and without a snapshot sharing the tree:
+ * the first write on each path after a snapshot copies that path
+ */
+static void bench_snapshot(void)
+{
+    static unsigned int keys[BENCH_MAX_ITEMS];
+    BTree *tree;
+    BTree *snapshot;
+    unsigned int i;
+    unsigned int run;
+
+    puts("Snapshots (1000 random keys):");
+
+    tree = btree_create();
+    if (!tree)
+        return;
+    for (i = 0; i < BENCH_MAX_ITEMS; i++)
+    {
+        keys[i] = (unsigned int)rand();
+        btree_insert(tree, keys[i], (void *)(i + 1));
+    }
+
+    bench_start();
+    for (i = 0; i < BENCH_SNAPSHOTS; i++)
+        btree_free(btree_snapshot(tree));
+    bench_stop("btree_snapshot+btree_free", BENCH_SNAPSHOTS);
+
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_update(tree, keys[i], (void *)(run + 1));
+    bench_stop("btree_update (no snapshot)", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    /* A fresh snapshot each run, so every run pays for the copies */
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+    {
+        snapshot = btree_snapshot(tree);
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_update(tree, keys[i], (void *)(run + 1));
+        btree_free(snapshot);
+    }
+    bench_stop("btree_update (snapshot)", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    btree_free(tree);
+    putchar('\n');
+}
+#endif
+
+/* One point of the order/search-strategy sweep (see BTREE_BENCH_SWEEP) */
+static void bench_search(void)
+{
+    static const char *names[] = {"linear", "binary", "unrolled"};
+    BTree *tree;
+    unsigned int i;
+    unsigned int run;
+
+    printf("In-node search: order %u, %s\n", BTREE_MAX_CHILDREN, names[BTREE_SEARCH]);
+
+    tree = btree_create();
+    if (!tree)
+        return;
+
+    for (i = 0; i < BENCH_MAX_ITEMS; i++)
+        btree_insert(tree, i, (void *)(i + 1));
+
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_get(tree, (unsigned int)rand() % BENCH_MAX_ITEMS);
+    bench_stop("btree_get (random hit)", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    btree_free(tree);
+    putchar('\n');
+}
+
+/* Per-call cost of the point operations on a 1000-key tree */
+static void bench_point(void)
+{
+    BTree *tree;
+    unsigned int i;
+    unsigned int run;
+
+    puts("Point operations (1000 keys):");
+
+    tree = btree_create();
+    if (!tree)
+        return;
+
+    bench_start();
+    for (i = 0; i < BENCH_MAX_ITEMS; i++)
+        btree_insert(tree, i, (void *)(i + 1));
+    bench_stop("btree_insert", BENCH_MAX_ITEMS);
+
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_get(tree, (unsigned int)rand() % BENCH_MAX_ITEMS);
+    bench_stop("btree_get (random hit)", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_get(tree, BENCH_MAX_ITEMS + i);
+    bench_stop("btree_get (miss)", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    /* Same shape as the main.c delete phase: item_count/2 random deletes */
+    bench_start();
+    for (i = 0; i < BENCH_MAX_ITEMS / 2; i++)
+        btree_delete(tree, (unsigned int)rand() % BENCH_MAX_ITEMS);
+    bench_stop("btree_delete (random)", BENCH_MAX_ITEMS / 2);
+
+    btree_free(tree);
+    putchar('\n');
+}
+
+/* B-tree vs hash index on the same keys: point gets, table bytes and
+ * the longest lookup. keys holds BENCH_MAX_ITEMS distinct keys.
+ */
+static void bench_hash_run(const char *label, unsigned int *keys)
+{
+    BTree *tree;
+    BTreeNode *node;
+    HashIdx *index;
+    unsigned int i;
+    unsigned int run;
+    unsigned char height;
+
+    printf(" %s\n", label);
+
+    tree = btree_create();
+    index = hashidx_create();
+    if (!tree || !index)
+    {
+        btree_free(tree);
+        hashidx_free(index);
+        return;
+    }
+    for (i = 0; i < BENCH_MAX_ITEMS; i++)
+    {
+        btree_insert(tree, keys[i], (void *)(i + 1));
+        hashidx_insert(index, keys[i], (void *)(i + 1));
+    }
+
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_get(tree, keys[(unsigned int)rand() % BENCH_MAX_ITEMS]);
+    bench_stop("btree_get (random hit)", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            hashidx_get(index, keys[(unsigned int)rand() % BENCH_MAX_ITEMS]);
+    bench_stop("hashidx_get (random hit)", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            hashidx_get(index, (unsigned int)rand());
+    bench_stop("hashidx_get (random key)", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    height = 1;
+    for (node = tree->root; !node->is_leaf; node = node->children[0])
+        height++;
+
+    printf("  btree:   %5u bytes, %u nodes per lookup\n", btree_memory_usage(tree), height);
+    printf("  hashidx: %5u bytes, %u slots longest probe\n",
+           hashidx_memory_usage(index), hashidx_max_probe(index));
+
+    btree_free(tree);
+    hashidx_free(index);
+}
+
+static void bench_hash(void)
+{
+    static unsigned int keys[BENCH_MAX_ITEMS];
+    HashIdx *seen;
+    unsigned int key;
+    unsigned int i;
+
+    puts("B-tree vs hash index (1000 keys):");
+
+    for (i = 0; i < BENCH_MAX_ITEMS; i++)
+        keys[i] = i;
+    bench_hash_run("sequential keys", keys);
+
+    /* Distinct random keys; the hash index itself weeds out repeats */
+    seen = hashidx_create();
+    if (!seen)
+        return;
+    for (i = 0; i < BENCH_MAX_ITEMS; )
+    {
+        key = (unsigned int)rand();
+        if (hashidx_get(seen, key))
+            continue;
+        hashidx_insert(seen, key, (void *)1);
+        keys[i++] = key;
+    }
+    hashidx_free(seen);
+    bench_hash_run("random keys", keys);
+
+    putchar('\n');
+}
+
+static unsigned char bench_visit(unsigned int key, void *value, void *ctx)
+{
+    (*(unsigned int *)ctx) += key + (unsigned int)value;
+    return 1;
+}
+
+/* Exporting every key in order: one range scan vs a btree_get per key */
+static void bench_scan(void)
+{
+    BTree *tree;
+    unsigned int i;
+    unsigned int run;
+    unsigned int sum;
+
+    puts("Ordered export (1000 keys):");
+
+    tree = btree_create();
+    if (!tree)
+        return;
+
+    for (i = 0; i < BENCH_MAX_ITEMS; i++)
+        btree_insert(tree, i, (void *)(i + 1));
+
+    sum = 0;
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            sum += i + (unsigned int)btree_get(tree, i);
+    bench_stop("btree_get per key", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        btree_range(tree, 0, BENCH_MAX_ITEMS - 1, bench_visit, &sum);
+    bench_stop("btree_range", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    btree_free(tree);
+    putchar('\n');
+}
+
+/* Building from sorted keys: bulk load vs one btree_insert per key */
+static void bench_bulk(void)
+{
+    static unsigned int keys[BENCH_MAX_ITEMS];
+    BTree *tree;
+    unsigned int items;
+    unsigned int i;
+    unsigned int run;
+    unsigned int nodes;
+
+    puts("Sorted build (insert vs bulk load at 100% fill):");
+
+    for (i = 0; i < BENCH_MAX_ITEMS; i++)
+        keys[i] = i;
+
+    for (items = 100; items <= BENCH_MAX_ITEMS; items += 300)
+    {
+        printf(" %u keys\n", items);
+
+        nodes = 0;
+        bench_start();
+        for (run = 0; run < BENCH_RUNS; run++)
+        {
+            tree = btree_create();
+            if (!tree)
+                return;
+            for (i = 0; i < items; i++)
+                btree_insert(tree, i, (void *)(i + 1));
+            nodes = btree_node_count(tree);
+            btree_free(tree);
+        }
+        bench_stop("btree_insert", (unsigned long)BENCH_RUNS * items);
+        printf("  %u nodes\n", nodes);
+
+        bench_start();
+        for (run = 0; run < BENCH_RUNS; run++)
+        {
+            tree = btree_create();
+            if (!tree)
+                return;
+            btree_bulk_load(tree, keys, NULL, items, 100);
+            nodes = btree_node_count(tree);
+            btree_free(tree);
+        }
+        bench_stop("btree_bulk_load", (unsigned long)BENCH_RUNS * items);
+        printf("  %u nodes\n", nodes);
+    }
+    putchar('\n');
+}
+
+#define BENCH_RANGE_RUNS 50
+
+/* Clock ticks to bulk load BENCH_MAX_ITEMS keys and then delete keys
+ * 0..span-1 one at a time (how 1), as one range (how 2) or not at all
+ * (how 0), BENCH_RANGE_RUNS times over
+ */
+static unsigned long bench_range_run(unsigned int *keys, unsigned int span, unsigned char how)
+{
+    BTree *tree;
+    unsigned int run;
+    unsigned int i;
+    clock_t started;
+
+    started = clock();
+    for (run = 0; run < BENCH_RANGE_RUNS; run++)
+    {
+        tree = btree_create();
+        if (!tree)
+            break;
+        btree_bulk_load(tree, keys, NULL, BENCH_MAX_ITEMS, 50);
+        if (how == 1)
+            for (i = 0; i < span; i++)
+                btree_delete(tree, i);
+        else if (how == 2)
+            btree_delete_range(tree, 0, span - 1);
+        btree_free(tree);
+    }
+
+    return (unsigned long)(clock() - started);
+}
+
+static void bench_range_report(const char *label, unsigned long ticks, unsigned long base, unsigned int span)
+{
+    unsigned long keys;
+
+    /* Take away the load and free every run pays */
+    ticks = ticks > base ? ticks - base : 1;
+    keys = (unsigned long)BENCH_RANGE_RUNS * span;
+    printf("  %-26s %6lu ms %7lu cyc/key %7lu keys/s\n", label,
+           ticks * 1000UL / CLOCKS_PER_SEC,
+           ticks * (BENCH_PHI2_KHZ * 1000UL / CLOCKS_PER_SEC) / keys,
+           keys * CLOCKS_PER_SEC / ticks);
+}
+
+/* Purge the 0..N block of a half-full 1000-key tree */
+static void bench_range(void)
+{
+    static unsigned int keys[BENCH_MAX_ITEMS];
+    unsigned long base;
+    unsigned int span;
+    unsigned int i;
+
+    puts("Range delete (per-key loop vs btree_delete_range):");
+
+    for (i = 0; i < BENCH_MAX_ITEMS; i++)
+        keys[i] = i;
+
+    for (span = 100; span <= BENCH_MAX_ITEMS; span += 300)
+    {
+        printf(" keys 0..%u\n", span - 1);
+        base = bench_range_run(keys, span, 0);
+        bench_range_report("btree_delete loop", bench_range_run(keys, span, 1), base, span);
+        bench_range_report("btree_delete_range", bench_range_run(keys, span, 2), base, span);
+    }
+    putchar('\n');
+}
+
+/* Ascending inserts under each split policy */
+static void bench_split(void)
+{
+    static const char *names[] = {"middle", "append"};
+    BTree *tree;
+    unsigned char policy;
+    unsigned int i;
+    unsigned int nodes;
+
+    puts("Split policy (1000 ascending keys):");
+
+    for (policy = BTREE_SPLIT_MIDDLE; policy <= BTREE_SPLIT_APPEND; policy++)
+    {
+        tree = btree_create();
+        if (!tree)
+            return;
+        btree_set_split_policy(tree, policy);
+
+        bench_start();
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_insert(tree, i, (void *)(i + 1));
+        bench_stop(names[policy], BENCH_MAX_ITEMS);
+
+        nodes = btree_node_count(tree);
+        printf("  %u nodes, %u keys/node\n", nodes, BENCH_MAX_ITEMS / nodes);
+
+        btree_free(tree);
+    }
+    putchar('\n');
+}
+
+#define BENCH_BATCH_MAX 256
+
+/* Print how many times faster the batch call was, from two cyc/op figures */
+static void bench_speedup(unsigned long single, unsigned long many)
+{
+    if (many)
+        printf("  speedup %lu.%02lux\n", single / many, single * 100UL / many % 100UL);
+}
+
+/* One key at a time vs batches of 8 to 256 random keys, the same number
+ * of keys for every batch size
+ */
+static void bench_batch(void)
+{
+    static unsigned int keys[BENCH_MAX_ITEMS];
+    static BTreeKey batch[BENCH_BATCH_MAX];
+    static BTreeValue values[BENCH_BATCH_MAX];
+    BTree *tree;
+    BTree *other;
+    BTreeCursor cursor;
+    unsigned long single;
+    unsigned long many;
+    unsigned int size;
+    unsigned int runs;
+    unsigned int run;
+    unsigned int i;
+
+    puts("Batch get/insert (1000 random keys):");
+
+    tree = btree_create();
+    if (!tree)
+        return;
+    for (i = 0; i < BENCH_MAX_ITEMS; i++)
+    {
+        keys[i] = (unsigned int)rand();
+        btree_insert(tree, keys[i], (void *)(i + 1));
+    }
+    for (i = 0; i < BENCH_BATCH_MAX; i++)
+        values[i] = (void *)(i + 1);
+
+    for (size = 8; size <= BENCH_BATCH_MAX; size *= 2)
+    {
+        printf(" batch of %u\n", size);
+        runs = BENCH_RUNS * (BENCH_BATCH_MAX / size);
+
+        for (i = 0; i < size; i++)
+            batch[i] = keys[(unsigned int)rand() % BENCH_MAX_ITEMS];
+
+        bench_start();
+        for (run = 0; run < runs; run++)
+            for (i = 0; i < size; i++)
+                btree_get(tree, batch[i]);
+        single = bench_stop("btree_get (random)", (unsigned long)runs * size);
+
+        bench_start();
+        for (run = 0; run < runs; run++)
+            btree_get_many(tree, batch, size, values);
+        many = bench_stop("btree_get_many (random)", (unsigned long)runs * size);
+        bench_speedup(single, many);
+
+        /* A burst of neighbouring keys, as arrives in order from a sender */
+        btree_cursor_seek(&cursor, tree, (unsigned int)rand());
+        for (i = 0; i < size; i++)
+        {
+            batch[i] = btree_cursor_key(&cursor);
+            if (!btree_cursor_next(&cursor))
+                btree_cursor_seek(&cursor, tree, 0);
+        }
+
+        bench_start();
+        for (run = 0; run < runs; run++)
+            for (i = 0; i < size; i++)
+                btree_get(tree, batch[i]);
+        single = bench_stop("btree_get (neighbour)", (unsigned long)runs * size);
+
+        bench_start();
+        for (run = 0; run < runs; run++)
+            btree_get_many(tree, batch, size, values);
+        many = bench_stop("btree_get_many (neighbour)", (unsigned long)runs * size);
+        bench_speedup(single, many);
+
+        /* New keys into two equal trees; run picks a fresh set each time */
+        other = btree_create();
+        if (!other)
+            break;
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_insert(other, keys[i], (void *)(i + 1));
+
+        bench_start();
+        for (run = 0; run < runs; run++)
+            for (i = 0; i < size; i++)
+                btree_insert(other, (run * size + i) * 40503U, values[i]);
+        single = bench_stop("btree_insert", (unsigned long)runs * size);
+        btree_free(other);
+
+        other = btree_create();
+        if (!other)
+            break;
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_insert(other, keys[i], (void *)(i + 1));
+
+        bench_start();
+        for (run = 0; run < runs; run++)
+        {
+            for (i = 0; i < size; i++)
+                batch[i] = (run * size + i) * 40503U;
+            btree_insert_many(other, batch, values, size);
+        }
+        many = bench_stop("btree_insert_many", (unsigned long)runs * size);
+        bench_speedup(single, many);
+        btree_free(other);
+    }
+
+    btree_free(tree);
+    putchar('\n');
+}
+
+/* Counter bump for btree_upsert(): new keys start at 1 */
+static BTreeValue bench_bump(BTreeKey key, BTreeValue value, void *ctx)
+{
+    (void)key;
+    (void)ctx;
+    return (void *)((unsigned int)value + 1);
+}
+
+/* Read-modify-write: two calls per key vs one descent through the slot */
+static void bench_upsert(void)
+{
+    static unsigned int keys[BENCH_MAX_ITEMS];
+    BTree *tree;
+    BTreeValue *slot;
+    unsigned int i;
+    unsigned int run;
+
+    puts("Read-modify-write (1000 random keys):");
+
+    tree = btree_create();
+    if (!tree)
+        return;
+    for (i = 0; i < BENCH_MAX_ITEMS; i++)
+    {
+        keys[i] = (unsigned int)rand();
+        btree_insert(tree, keys[i], (void *)(i + 1));
+    }
+
+    /* The main.c update check */
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+        {
+            btree_update(tree, keys[i], (void *)(run + 1));
+            btree_get(tree, keys[i]);
+        }
+    bench_stop("btree_update+btree_get", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+        {
+            slot = btree_get_slot(tree, keys[i], 0);
+            if (slot && *slot)
+                *slot = (void *)(run + 1);
+        }
+    bench_stop("btree_get_slot", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    /* Counting: get the count, then insert it plus one */
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_insert(tree, keys[i], (void *)((unsigned int)btree_get(tree, keys[i]) + 1));
+    bench_stop("btree_get+btree_insert", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_upsert(tree, keys[i], bench_bump, NULL);
+    bench_stop("btree_upsert", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    btree_free(tree);
+    putchar('\n');
+}
+
+/* Local lookups with and without the finger */
+static void bench_finger(void)
+{
+    BTree *tree;
+    BTreeFingerStats stats;
+    unsigned char on;
+    unsigned int i;
+    unsigned int key;
+    unsigned int run;
+
+    puts("Finger (1000 keys):");
+
+    for (on = 0; on < 2; on++)
+    {
+        printf(" finger %s\n", on ? "on" : "off");
+
+        tree = btree_create();
+        if (!tree)
+            return;
+        btree_set_finger(tree, on);
+
+        bench_start();
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_insert(tree, i, (void *)(i + 1));
+        bench_stop("btree_insert (ascending)", BENCH_MAX_ITEMS);
+
+        bench_start();
+        for (run = 0; run < BENCH_RUNS; run++)
+            for (i = 0; i < BENCH_MAX_ITEMS; i++)
+                btree_get(tree, i);
+        bench_stop("btree_get (ascending)", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+        /* The main.c miss diagnostics: a key, then both neighbours */
+        bench_start();
+        for (run = 0; run < BENCH_RUNS; run++)
+            for (i = 0; i < BENCH_MAX_ITEMS / 3; i++)
+            {
+                key = (unsigned int)rand() % (BENCH_MAX_ITEMS - 2) + 1;
+                btree_get(tree, key);
+                btree_get(tree, key - 1);
+                btree_get(tree, key + 1);
+            }
+        bench_stop("btree_get (key, key+-1)", (unsigned long)BENCH_RUNS * (BENCH_MAX_ITEMS / 3) * 3);
+
+        if (btree_finger_stats(tree, &stats))
+            printf("  %u hits, %u misses\n", stats.hits, stats.misses);
+
+        btree_free(tree);
+    }
+    putchar('\n');
+}
+
+/* Keys that fit when inserted in ascending order until memory runs out */
+static unsigned int bench_capacity(unsigned char xram)
+{
+    BTree *tree;
+    PBTree *ptree;
+    unsigned int count;
+
+    count = 0;
+    if (xram)
+    {
+        ptree = pbtree_create(PBTREE_XRAM_BASE, PBTREE_XRAM_PAGES);
+        if (!ptree)
+            return 0;
+        while (count < 0xFFFF && pbtree_insert(ptree, count, count))
+            count++;
+        pbtree_free(ptree);
+        return count;
+    }
+
+    tree = btree_create();
+    if (!tree)
+        return 0;
+    while (count < 0xFFFF)
+    {
+        btree_insert(tree, count, (void *)(count + 1));
+        if (!btree_get(tree, count))
+            break; /* Heap exhausted, the insert was dropped */
+        count++;
+    }
+    btree_free(tree);
+    return count;
+}
+
+/* All-in-RAM tree vs the XRAM paged tree */
+static void bench_xram(void)
+{
+    BTree *tree;
+    PBTree *ptree;
+    PBTreeStats stats;
+    unsigned int i;
+    unsigned int run;
+    unsigned int value;
+
+    printf("XRAM paged tree (%u-byte pages, %u cached):\n",
+           PBTREE_PAGE_SIZE, PBTREE_CACHE_PAGES);
+
+    tree = btree_create();
+    ptree = pbtree_create(PBTREE_XRAM_BASE, PBTREE_XRAM_PAGES);
+    if (!tree || !ptree)
+        return;
+
+    bench_start();
+    for (i = 0; i < BENCH_MAX_ITEMS; i++)
+        btree_insert(tree, i, (void *)(i + 1));
+    bench_stop("btree_insert", BENCH_MAX_ITEMS);
+
+    bench_start();
+    for (i = 0; i < BENCH_MAX_ITEMS; i++)
+        pbtree_insert(ptree, i, i + 1);
+    bench_stop("pbtree_insert", BENCH_MAX_ITEMS);
+
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_get(tree, (unsigned int)rand() % BENCH_MAX_ITEMS);
+    bench_stop("btree_get (random hit)", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            pbtree_get(ptree, (unsigned int)rand() % BENCH_MAX_ITEMS, &value);
+    bench_stop("pbtree_get (random hit)", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    if (pbtree_stats(ptree, &stats))
+        printf("  %u/%u pages, cache %u hits %u misses, %u writes\n",
+               stats.used, stats.pages, stats.hits, stats.misses, stats.writes);
+
+    btree_free(tree);
+    pbtree_free(ptree);
+
+    puts(" Capacity (ascending keys):");
+    printf("  main RAM heap: %u keys\n", bench_capacity(0));
+    printf("  XRAM pages:    %u keys\n", bench_capacity(1));
+    putchar('\n');
+}
+
+/* Boot paths: reinsert every key from a flat dump vs open the page file
+ * and look up one key
+ */
+static void bench_persist(void)
+{
+    static unsigned int record[2];
+    BTree *tree;
+    PBTree *ptree;
+    FILE *dump;
+    unsigned int i;
+    unsigned int value;
+
+    puts("Persistence (1000 keys):");
+
+    tree = btree_create();
+    if (!tree)
+        return;
+    for (i = 0; i < BENCH_MAX_ITEMS; i++)
+        btree_insert(tree, i, (void *)(i + 1));
+
+    bench_start();
+    if (!btree_save(tree, "btree.pg"))
+        puts("  btree_save failed");
+    bench_stop("btree_save", BENCH_MAX_ITEMS);
+
+    dump = fopen("btree.dat", "wb");
+    if (dump)
+    {
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+        {
+            record[0] = i;
+            record[1] = i + 1;
+            fwrite(record, sizeof(record), 1, dump);
+        }
+        fclose(dump);
+    }
+    btree_free(tree);
+
+    dump = fopen("btree.dat", "rb");
+    tree = btree_create();
+    if (!dump || !tree)
+        return;
+    bench_start();
+    while (fread(record, sizeof(record), 1, dump) == 1)
+        btree_insert(tree, record[0], (void *)record[1]);
+    bench_stop("reload dump + insert", BENCH_MAX_ITEMS);
+    fclose(dump);
+    btree_free(tree);
+
+    bench_start();
+    ptree = btree_open("btree.pg");
+    if (ptree)
+        pbtree_get(ptree, BENCH_MAX_ITEMS / 2, &value);
+    bench_stop("btree_open + 1 lookup", 1);
+    if (ptree)
+        pbtree_free(ptree);
+
+    putchar('\n');
+}
+
+/* Subtree counts: what they add to inserts and deletes, and what they buy.
+ * Build with BTREE_ORDER_STATS=0 (btree_bench_nocounts) for the baseline.
+ */
+static void bench_order(void)
+{
+    BTree *tree;
+    BTreeCursor cursor;
+    unsigned int i;
+    unsigned int run;
+    unsigned int key;
+
+    printf("Order statistics (internal node %u bytes):\n", (unsigned int)BTREE_NODE_SIZE);
+
+    tree = btree_create();
+    if (!tree)
+        return;
+
+    srand(1);
+    bench_start();
+    for (i = 0; i < BENCH_MAX_ITEMS; i++)
+        btree_insert(tree, (unsigned int)rand() % (BENCH_MAX_ITEMS * 4), (void *)(i + 1));
+    bench_stop("btree_insert (random)", BENCH_MAX_ITEMS);
+
+#if BTREE_ORDER_STATS
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_select(tree, (unsigned int)rand() % btree_size(tree), &key);
+    bench_stop("btree_select", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_rank(tree, (unsigned int)rand() % (BENCH_MAX_ITEMS * 4));
+    bench_stop("btree_rank", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+#endif
+
+    /* Median without counts: step a cursor halfway */
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+    {
+        btree_cursor_seek(&cursor, tree, 0);
+        for (i = 0; i < btree_size(tree) / 2; i++)
+            btree_cursor_next(&cursor);
+        key = btree_cursor_key(&cursor);
+    }
+    bench_stop("median by cursor walk", BENCH_RUNS);
+
+#if BTREE_ORDER_STATS
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        btree_select(tree, btree_size(tree) / 2, &key);
+    bench_stop("median by btree_select", BENCH_RUNS);
+#endif
+
+    srand(2);
+    bench_start();
+    for (i = 0; i < BENCH_MAX_ITEMS / 2; i++)
+        btree_delete(tree, (unsigned int)rand() % (BENCH_MAX_ITEMS * 4));
+    bench_stop("btree_delete (random)", BENCH_MAX_ITEMS / 2);
+
+    btree_free(tree);
+    putchar('\n');
+}
+
+/* 8-bit keys and int values (btree_u8) vs the default 16-bit keys and
+ * void * values, on the 256 keys both can hold
+ */
+#define BENCH_KEY_ITEMS 256
+
+static void bench_keys(void)
+{
+    BTree *tree;
+    btree_u8_Tree *small;
+    unsigned int i;
+    unsigned int run;
+    unsigned int memory;
+
+    printf("Key width (leaf %u vs %u bytes, internal %u vs %u bytes):\n",
+           (unsigned int)BTREE_LEAF_SIZE, (unsigned int)sizeof(btree_u8_Leaf),
+           (unsigned int)BTREE_NODE_SIZE, (unsigned int)sizeof(btree_u8_Node));
+
+    tree = btree_create();
+    small = btree_u8_create();
+    if (!tree || !small)
+        return;
+
+    /* Multiplying by an odd number permutes 0..255 */
+    bench_start();
+    for (i = 0; i < BENCH_KEY_ITEMS; i++)
+        btree_insert(tree, (i * 97) & 0xFF, (void *)(i + 1));
+    bench_stop("16-bit btree_insert", BENCH_KEY_ITEMS);
+
+    bench_start();
+    for (i = 0; i < BENCH_KEY_ITEMS; i++)
+        btree_u8_insert(small, (unsigned char)(i * 97), (int)(i + 1));
+    bench_stop("8-bit btree_insert", BENCH_KEY_ITEMS);
+
+    srand(1);
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_get(tree, (unsigned int)rand() & 0xFF);
+    bench_stop("16-bit btree_get", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    srand(1);
+    bench_start();
+    for (run = 0; run < BENCH_RUNS; run++)
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_u8_get(small, (unsigned char)rand());
+    bench_stop("8-bit btree_get", (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+    memory = btree_memory_usage(tree);
+    printf("  16-bit: %3u nodes %5u bytes\n", btree_node_count(tree), memory);
+    memory = btree_u8_memory_usage(small);
+    printf("   8-bit: %3u nodes %5u bytes\n", btree_u8_node_count(small), memory);
+
+    btree_free(tree);
+    btree_u8_free(small);
+    putchar('\n');
+}
+
+#define BENCH_JSON_ITEMS 200
+
+/* A JSON value shaped like the main.c samples, returns its length with the NUL */
+static unsigned char bench_json(char *buf, unsigned int i)
+{
+    if (i & 1)
+        sprintf(buf, "{\"status\":\"%s\",\"code\":%u}", (i & 2) ? "pending" : "ok", 100 + i % 400);
+    else
+        sprintf(buf, "{\"user\":\"user%u\",\"role\":\"%s\"}", i, (i & 2) ? "admin" : "guest");
+    return (unsigned char)(strlen(buf) + 1);
+}
+
+/* JSON strings: a malloc() copy per value vs the slab value arena */
+static void bench_arena(void)
+{
+    static char json[64];
+    BTree *tree;
+    BTreeArena *arena;
+    BTreeArenaStats stats;
+    unsigned char len;
+    unsigned int i;
+    char *copy;
+#ifdef __CC65__
+    unsigned int heap;
+    unsigned int bytes;
+#endif
+
+    printf("Value arena (%u JSON strings):\n", BENCH_JSON_ITEMS);
+
+    tree = btree_create();
+    if (!tree)
+        return;
+#ifdef __CC65__
+    heap = _heapmemavail();
+    bytes = 0;
+#endif
+    bench_start();
+    for (i = 0; i < BENCH_JSON_ITEMS; i++)
+    {
+        len = bench_json(json, i);
+        copy = (char *)malloc(len);
+        if (!copy)
+            break;
+        memcpy(copy, json, len);
+        btree_insert(tree, i, copy);
+#ifdef __CC65__
+        bytes += len;
+#endif
+    }
+    bench_stop("malloc copy + btree_insert", BENCH_JSON_ITEMS);
+#ifdef __CC65__
+    printf("   %u bytes of overhead per string (nodes excluded)\n",
+           (unsigned int)((heap - _heapmemavail() - btree_memory_usage(tree) - bytes) / BENCH_JSON_ITEMS));
+#endif
+    for (i = 0; i < BENCH_JSON_ITEMS; i++)
+        free(btree_get(tree, i));
+    btree_free(tree);
+
+    tree = btree_create();
+    arena = btree_arena_create();
+    if (!tree || !arena)
+        return;
+    bench_start();
+    for (i = 0; i < BENCH_JSON_ITEMS; i++)
+    {
+        len = bench_json(json, i);
+        btree_put(tree, arena, i, json, len);
+    }
+    bench_stop("btree_put", BENCH_JSON_ITEMS);
+
+    bench_start();
+    for (i = 0; i < BENCH_JSON_ITEMS; i++)
+    {
+        len = bench_json(json, i + 2);
+        btree_put(tree, arena, i, json, len);
+    }
+    bench_stop("btree_put (update)", BENCH_JSON_ITEMS);
+
+    if (btree_arena_stats(arena, &stats) && stats.values)
+        printf("   %u bytes of overhead per string: %u chunk, %u slab slack\n",
+               (stats.slab_bytes - stats.value_bytes) / stats.values,
+               (stats.chunk_bytes - stats.value_bytes) / stats.values,
+               (stats.slab_bytes - stats.chunk_bytes) / stats.values);
+
+    bench_start();
+    for (i = 0; i < BENCH_JSON_ITEMS; i++)
+        btree_drop(tree, arena, i);
+    bench_stop("btree_drop", BENCH_JSON_ITEMS);
+
+    btree_free(tree);
+    btree_arena_destroy(arena);
+    putchar('\n');
+}
+
+/* Random inserts into a page file; group 0 runs without a journal */
+static void bench_journal_run(const char *label, unsigned char group, unsigned char sync_each)
+{
+    PBTree *ptree;
+    PBTreeStats stats;
+    unsigned int i;
+
+    ptree = pbtree_create_file("btree.pg");
+    if (!ptree)
+        return;
+    if (group)
+        pbtree_journal(ptree, group);
+
+    srand(1);
+    bench_start();
+    for (i = 0; i < BENCH_MAX_ITEMS; i++)
+    {
+        pbtree_insert(ptree, (unsigned int)rand(), i);
+        if (sync_each)
+            pbtree_sync(ptree);
+    }
+    pbtree_sync(ptree);
+    bench_stop(label, BENCH_MAX_ITEMS);
+
+    if (pbtree_stats(ptree, &stats))
+        printf("   %u page writes, %u journal writes, %u checkpoints\n",
+               stats.writes, stats.flushes, stats.checkpoints);
+    pbtree_free(ptree);
+}
+
+/* Durable inserts: page writes per operation vs the journal */
+static void bench_journal(void)
+{
+    puts("Page file inserts (1000 random keys):");
+    bench_journal_run("write-back, sync at end", 0, 0);
+    bench_journal_run("pbtree_sync per insert", 0, 1);
+    bench_journal_run("journal, group of 1", 1, 0);
+    bench_journal_run("journal, group of 16", PBTREE_JOURNAL_BATCH, 0);
+    putchar('\n');
+}
+
+/* btree_get on heap and pool nodes in the current key layout. Build with
+ * BTREE_BYTE_PLANES=1 (btree_bench_planes) for the byte-plane figures.
+ */
+static void bench_planes(void)
+{
+    BTree *tree;
+    unsigned char pooled;
+    unsigned int i;
+    unsigned int run;
+
+    printf("Key layout: %s (leaf %u bytes, internal %u bytes):\n",
+           BTREE_BYTE_PLANES ? "byte planes" : "16-bit keys",
+           (unsigned int)BTREE_LEAF_SIZE, (unsigned int)BTREE_NODE_SIZE);
+
+    for (pooled = 0; pooled < 2; pooled++)
+    {
+        tree = bench_tree(pooled);
+        if (!tree)
+            return;
+
+        srand(1);
+        for (i = 0; i < BENCH_MAX_ITEMS; i++)
+            btree_insert(tree, (unsigned int)rand(), (void *)(i + 1));
+
+        /* Replay the insert sequence, so every get is a hit */
+        bench_start();
+        for (run = 0; run < BENCH_RUNS; run++)
+        {
+            srand(1);
+            for (i = 0; i < BENCH_MAX_ITEMS; i++)
+                btree_get(tree, (unsigned int)rand());
+        }
+        bench_stop(pooled ? "btree_get (pool)" : "btree_get (heap)",
+                   (unsigned long)BENCH_RUNS * BENCH_MAX_ITEMS);
+
+        btree_free(tree);
+    }
+    putchar('\n');
+}
+
+#if BTREE_ASM_KERNELS
+/* C kernels against their ca65 versions (BTREE_ASM builds only): the same
+ * random nodes go through both and must come out byte for byte the same,
+ * then each kernel is timed on nearly full nodes.
+ */
+#define BENCH_KERNEL_ROUNDS 500
+#define BENCH_KERNEL_CALLS 5000
+
+static BTreeNode kernel_src;
+static BTreeNode kernel_c;
+static BTreeNode kernel_asm;
+
+/* Ascending keys in every slot, n of them in use */
+static void kernel_fill(BTreeNode *node, unsigned char n)
+{
+    unsigned char i;
+    unsigned int key;
+
+    key = (unsigned int)rand() % 512;
+    for (i = 0; i < BTREE_MAX_KEYS; i++)
+    {
+        key += 1 + (unsigned int)rand() % 300;
+        node->keys[i] = key;
+        node->values[i] = (void *)rand();
+    }
+    node->key_count = n;
+    node->is_leaf = 1;
+}
+
+static unsigned char kernel_same(void)
+{
+    return memcmp(&kernel_c, &kernel_asm, BTREE_LEAF_SIZE) == 0;
+}
+
+static void bench_kernels(void)
+{
+    unsigned int round;
+    unsigned int errors;
+    unsigned int key;
+    unsigned char n;
+    unsigned char i;
+    unsigned char si;
+    unsigned char di;
+
+    puts("Kernels, C vs ca65:");
+
+    errors = 0;
+    srand(1);
+    for (round = 0; round < BENCH_KERNEL_ROUNDS; round++)
+    {
+        n = (unsigned char)(1 + rand() % BTREE_MAX_KEYS);
+        i = (unsigned char)(rand() % n);
+        kernel_fill(&kernel_src, n);
+
+        /* Keys just below, at and above a stored key, and past the end */
+        key = kernel_src.keys[i] + (unsigned int)(rand() % 3) - 1;
+        if (btree_node_find(&kernel_src, key) != btree_node_find_asm(&kernel_src, key))
+            errors++;
+        key = kernel_src.keys[n - 1] + 1;
+        if (btree_node_find(&kernel_src, key) != btree_node_find_asm(&kernel_src, key))
+            errors++;
+
+        if (n < BTREE_MAX_KEYS)
+        {
+            kernel_c = kernel_src;
+            kernel_asm = kernel_src;
+            btree_node_open(&kernel_c, i);
+            btree_node_open_asm(&kernel_asm, i);
+            if (!kernel_same())
+                errors++;
+        }
+
+        kernel_c = kernel_src;
+        kernel_asm = kernel_src;
+        btree_node_close(&kernel_c, i);
+        btree_node_close_asm(&kernel_asm, i);
+        if (!kernel_same())
+            errors++;
+
+        n = (unsigned char)(rand() % (BTREE_MAX_KEYS + 1));
+        si = (unsigned char)(rand() % (BTREE_MAX_KEYS - n + 1));
+        di = (unsigned char)(rand() % (BTREE_MAX_KEYS - n + 1));
+        kernel_fill(&kernel_c, BTREE_MAX_KEYS);
+        kernel_asm = kernel_c;
+        btree_node_copy(&kernel_c, di, &kernel_src, si, n);
+        btree_node_copy_asm(&kernel_asm, di, &kernel_src, si, n);
+        if (!kernel_same())
+            errors++;
+    }
+    printf("  %u rounds, %u mismatches\n", BENCH_KERNEL_ROUNDS, errors);
+
+    /* Timing on nodes one key short of full */
+    n = BTREE_MAX_KEYS - 1;
+    kernel_fill(&kernel_src, n);
+    kernel_c = kernel_src;
+    key = kernel_src.keys[n - 1];
+
+    bench_start();
+    for (round = 0; round < BENCH_KERNEL_CALLS; round++)
+        btree_node_find(&kernel_src, key);
+    bench_stop("find (C)", BENCH_KERNEL_CALLS);
+    bench_start();
+    for (round = 0; round < BENCH_KERNEL_CALLS; round++)
+        btree_node_find_asm(&kernel_src, key);
+    bench_stop("find (ca65)", BENCH_KERNEL_CALLS);
+
+    bench_start();
+    for (round = 0; round < BENCH_KERNEL_CALLS; round++)
+        btree_node_open(&kernel_c, 0);
+    bench_stop("open (C)", BENCH_KERNEL_CALLS);
+    bench_start();
+    for (round = 0; round < BENCH_KERNEL_CALLS; round++)
+        btree_node_open_asm(&kernel_c, 0);
+    bench_stop("open (ca65)", BENCH_KERNEL_CALLS);
+
+    bench_start();
+    for (round = 0; round < BENCH_KERNEL_CALLS; round++)
+        btree_node_close(&kernel_c, 0);
+    bench_stop("close (C)", BENCH_KERNEL_CALLS);
+    bench_start();
+    for (round = 0; round < BENCH_KERNEL_CALLS; round++)
+        btree_node_close_asm(&kernel_c, 0);
+    bench_stop("close (ca65)", BENCH_KERNEL_CALLS);
+
+    bench_start();
+    for (round = 0; round < BENCH_KERNEL_CALLS; round++)
+        btree_node_copy(&kernel_c, 0, &kernel_src, BTREE_SPLIT_INDEX + 1, BTREE_MAX_KEYS - BTREE_SPLIT_INDEX - 1);
+    bench_stop("copy (C)", BENCH_KERNEL_CALLS);
+    bench_start();
+    for (round = 0; round < BENCH_KERNEL_CALLS; round++)
+        btree_node_copy_asm(&kernel_c, 0, &kernel_src, BTREE_SPLIT_INDEX + 1, BTREE_MAX_KEYS - BTREE_SPLIT_INDEX - 1);
+    bench_stop("copy (ca65)", BENCH_KERNEL_CALLS);
+
+    putchar('\n');
+}
+#endif
+
+/* Node RAM with compact leaves vs every node carrying a children array */
+static void bench_layout(void)
+{
+    BTree *tree;
+    unsigned int items;
+    unsigned int i;
+    unsigned int nodes;
+    unsigned int leaves;
+    unsigned int uniform;
+    unsigned int compact;
+
+    printf("Node layout (leaf %u bytes, internal %u bytes):\n",
+           (unsigned int)BTREE_LEAF_SIZE, (unsigned int)BTREE_NODE_SIZE);
+
+    for (items = 100; items <= BENCH_MAX_ITEMS; items += 300)
+    {
+        tree = btree_create();
+        if (!tree)
+            return;
+
+        for (i = 0; i < items; i++)
+            btree_insert(tree, i, (void *)(i + 1));
+
+        nodes = btree_node_count(tree);
+        leaves = btree_leaf_count(tree);
+        uniform = (unsigned int)(nodes * BTREE_NODE_SIZE);
+        compact = btree_memory_usage(tree);
+        printf("  %4u keys: %3u nodes (%3u leaves) %5u -> %5u bytes (-%u%%)\n",
+               items, nodes, leaves, uniform, compact,
+               (unsigned int)((unsigned long)(uniform - compact) * 100 / uniform));
+
+        btree_free(tree);
+    }
+    putchar('\n');
+}
+
+void main()
+{
+    puts("=== B-tree Benchmarks ===\n");
+
+    bench_search();
+#if BTREE_ASM_KERNELS
+    bench_kernels();
+#endif
+#ifndef BENCH_SWEEP
+    bench_point();
+    bench_hash();
+    bench_scan();
+    bench_alloc();
+    bench_clear();
+    bench_bulk();
+    bench_range();
+    bench_split();
+    bench_finger();
+    bench_batch();
+    bench_upsert();
+#if BTREE_FILTER
+    bench_filter();
+#endif
+    bench_freeze();
+#if BTREE_SNAPSHOTS
+    bench_snapshot();
+#endif
+    bench_order();
+    bench_keys();
+    bench_arena();
+    bench_layout();
+    bench_planes();
+    bench_xram();
+    bench_persist();
+    bench_journal();
+#endif
+
+    puts("Benchmarks complete.");
+}
@@ -0,0 +1,189 @@
+#include "btree_int.h"
+#include <stddef.h>
+
+/* Bottom-up bulk loader.
+ * The shape of every level is planned up front from n alone: level l has
+ * nodes[l] nodes, the first extra[l] of them holding base[l] + 1 keys and
+ * the rest base[l]. Keys then arrive in order and each one goes to the
+ * lowest level whose current node still has room, which is exactly the
+ * in-order sequence of the finished tree. Only the rightmost node of each
+ * level is open at any time.
+ */
+
+typedef struct
+{
+    unsigned char levels;
+    unsigned char base[BTREE_MAX_HEIGHT];
+    unsigned int extra[BTREE_MAX_HEIGHT];
+    unsigned int made[BTREE_MAX_HEIGHT];  /* Nodes started so far per level */
+    BTreeNode *open[BTREE_MAX_HEIGHT];    /* Rightmost, still filling node per level */
+} BulkPlan;
+
+/* Split n keys into nodes of about per_node keys. Separators between the
+ * nodes move up a level, so c nodes hold n - (c - 1) keys.
+ */
+static unsigned int bulk_node_count(unsigned int n, unsigned char per_node)
+{
+    unsigned int c;
+    unsigned int c_min;
+
+    c = (unsigned int)(((unsigned long)n + 1) / (per_node + 1));
+    if (c == 0)
+        c = 1;
+
+    /* Never exceed a full node */
+    c_min = (unsigned int)(((unsigned long)n + 1 + BTREE_MAX_KEYS) / (BTREE_MAX_KEYS + 1));
+    if (c < c_min)
+        c = c_min;
+
+    return c;
+}
+
+static unsigned char bulk_plan(BulkPlan *plan, unsigned int n, unsigned char per_node)
+{
+    unsigned int c;
+    unsigned int keys;
+    unsigned char l;
+
+    l = 0;
+    do
+    {
+        if (l >= BTREE_MAX_HEIGHT)
+            return 0;
+
+        c = bulk_node_count(n, per_node);
+        keys = n - (c - 1);
+        plan->base[l] = (unsigned char)(keys / c);
+        plan->extra[l] = keys % c;
+        plan->made[l] = 0;
+        plan->open[l] = NULL;
+        l++;
+
+        n = c - 1;
+    } while (c > 1);
+
+    plan->levels = l;
+    return 1;
+}
+
+static unsigned char bulk_target(BulkPlan *plan, unsigned char l)
+{
+    return (unsigned char)(plan->base[l] + (plan->made[l] <= plan->extra[l] ? 1 : 0));
+}
+
+/* Hang every open node below `above` under its parent */
+static void bulk_close(BulkPlan *plan, unsigned char above)
+{
+    BTreeNode *parent;
+    unsigned char l;
+
+    for (l = 0; l < above; l++)
+    {
+        parent = plan->open[l + 1];
+        parent->children[parent->key_count] = plan->open[l];
+#if BTREE_ORDER_STATS
+        parent->counts[parent->key_count] = btree_node_total(plan->open[l]);
+#endif
+        plan->open[l] = NULL;
+    }
+}
+
+/* Failure cleanup: link what has been built and free it */
+static void bulk_discard(BTree *tree, BulkPlan *plan)
+{
+    unsigned char l;
+
+    for (l = 0; l < plan->levels; l++)
+    {
+        if (!plan->open[l])
+            continue;
+
+        if (l + 1 < plan->levels && plan->open[l + 1])
+            plan->open[l + 1]->children[plan->open[l + 1]->key_count] = plan->open[l];
+        else
+            btree_free_nodes(tree, plan->open[l]);
+    }
+}
+
+unsigned char btree_bulk_load(BTree *tree, BTreeKey *keys, BTreeValue *values, unsigned int n, unsigned char fill_percent)
+{
+    BulkPlan plan;
+    BTreeNode *node;
+    unsigned int i;
+    unsigned char per_node;
+    unsigned char l;
+
+    if (!tree || !tree->root || !keys)
+        return 0;
+
+    /* Only an empty tree can be bulk loaded */
+    if (!tree->root->is_leaf || tree->root->key_count != 0)
+        return 0;
+
+    if (n == 0)
+        return 1;
+
+    for (i = 1; i < n; i++)
+        if (!BTREE_KEY_LESS(keys[i - 1], keys[i]))
+            return 0; /* Input must be sorted and unique */
+
+    if (fill_percent > 100)
+        fill_percent = 100;
+    per_node = (unsigned char)((unsigned int)BTREE_MAX_KEYS * fill_percent / 100);
+    if (per_node < BTREE_MIN_KEYS)
+        per_node = BTREE_MIN_KEYS;
+    if (per_node == 0)
+        per_node = 1;
+
+    if (!bulk_plan(&plan, n, per_node))
+        return 0;
+
+    for (i = 0; i < n; i++)
+    {
+        /* Lowest level whose open node has room */
+        l = 0;
+        while (l < plan.levels && plan.open[l] && plan.open[l]->key_count == bulk_target(&plan, l))
+            l++;
+
+        if (l == plan.levels)
+        {
+            bulk_discard(tree, &plan);
+            return 0;
+        }
+
+        node = plan.open[l];
+        if (!node)
+        {
+            node = btree_node_create(tree, (unsigned char)(l == 0));
+            if (!node)
+            {
+                bulk_discard(tree, &plan);
+                return 0;
+            }
+            plan.open[l] = node;
+            plan.made[l]++;
+        }
+
+        /* The nodes below are complete now */
+        bulk_close(&plan, l);
+
+        btree_key_set(node, node->key_count, keys[i]);
+        node->values[node->key_count] = values ? values[i] : BTREE_VALUE_NONE;
+        node->key_count++;
+    }
+
+    bulk_close(&plan, (unsigned char)(plan.levels - 1));
+
+    btree_finger_drop(tree);
+    btree_free_nodes(tree, tree->root); /* The empty root may be shared */
+    tree->root = plan.open[plan.levels - 1];
+    tree->size = n;
+
+#if BTREE_FILTER
+    if (tree->filter)
+        for (i = 0; i < n; i++)
+            btree_filter_add(tree, keys[i]);
+#endif
+
+    return 1;
+}
@@ -0,0 +1,198 @@
+#include "btree_int.h"
+#include <stddef.h>
+
+/* Walk down to the leftmost (or rightmost) key below child `child` of the
+ * node at the top of the path.
+ */
+static unsigned char cursor_descend(BTreeCursor *cursor, unsigned char child, unsigned char rightmost)
+{
+    BTreeNode *node;
+    unsigned char top;
+
+    top = (unsigned char)(cursor->depth - 1);
+    cursor->index[top] = child;
+    node = cursor->path[top]->children[child];
+
+    while (1)
+    {
+        if (cursor->depth >= BTREE_MAX_HEIGHT)
+        {
+            cursor->depth = 0;
+            return 0;
+        }
+
+        top = cursor->depth;
+        cursor->depth++;
+        cursor->path[top] = node;
+
+        if (node->is_leaf)
+        {
+            cursor->index[top] = rightmost ? (unsigned char)(node->key_count - 1) : 0;
+            return 1;
+        }
+
+        cursor->index[top] = rightmost ? node->key_count : 0;
+        node = node->children[cursor->index[top]];
+    }
+}
+
+unsigned char btree_cursor_seek(BTreeCursor *cursor, BTree *tree, BTreeKey key)
+{
+    BTreeNode *node;
+    unsigned char i;
+    unsigned char top;
+
+    cursor->depth = 0;
+    if (!tree || !tree->root)
+        return 0;
+
+    node = tree->root;
+
+    while (cursor->depth < BTREE_MAX_HEIGHT)
+    {
+        i = node_find(node, key);
+        top = cursor->depth;
+        cursor->path[top] = node;
+        cursor->index[top] = i;
+        cursor->depth++;
+
+        if (i < node->key_count && BTREE_KEY_EQ(key, btree_key(node, i)))
+            return 1;
+
+        if (node->is_leaf)
+        {
+            if (i < node->key_count)
+                return 1;
+
+            /* Past the end of this leaf: the successor is the first
+             * ancestor we entered from a child left of its last key.
+             */
+            while (cursor->depth > 1)
+            {
+                cursor->depth--;
+                top = (unsigned char)(cursor->depth - 1);
+                if (cursor->index[top] < cursor->path[top]->key_count)
+                    return 1;
+            }
+
+            cursor->depth = 0;
+            return 0;
+        }
+
+        node = node->children[i];
+    }
+
+    cursor->depth = 0;
+    return 0;
+}
+
+unsigned char btree_cursor_next(BTreeCursor *cursor)
+{
+    BTreeNode *node;
+    unsigned char top;
+
+    if (cursor->depth == 0)
+        return 0;
+
+    top = (unsigned char)(cursor->depth - 1);
+    node = cursor->path[top];
+
+    /* Internal key: its successor is the leftmost key of the right subtree */
+    if (!node->is_leaf)
+        return cursor_descend(cursor, (unsigned char)(cursor->index[top] + 1), 0);
+
+    if (cursor->index[top] + 1 < node->key_count)
+    {
+        cursor->index[top]++;
+        return 1;
+    }
+
+    /* End of leaf: climb until we arrive from a child left of a key */
+    while (cursor->depth > 1)
+    {
+        cursor->depth--;
+        top = (unsigned char)(cursor->depth - 1);
+        if (cursor->index[top] < cursor->path[top]->key_count)
+            return 1;
+    }
+
+    cursor->depth = 0;
+    return 0;
+}
+
+unsigned char btree_cursor_prev(BTreeCursor *cursor)
+{
+    BTreeNode *node;
+    unsigned char top;
+
+    if (cursor->depth == 0)
+        return 0;
+
+    top = (unsigned char)(cursor->depth - 1);
+    node = cursor->path[top];
+
+    /* Internal key: its predecessor is the rightmost key of the left subtree */
+    if (!node->is_leaf)
+        return cursor_descend(cursor, cursor->index[top], 1);
+
+    if (cursor->index[top] > 0)
+    {
+        cursor->index[top]--;
+        return 1;
+    }
+
+    /* Start of leaf: climb until we arrive from a child right of a key */
+    while (cursor->depth > 1)
+    {
+        cursor->depth--;
+        top = (unsigned char)(cursor->depth - 1);
+        if (cursor->index[top] > 0)
+        {
+            cursor->index[top]--;
+            return 1;
+        }
+    }
+
+    cursor->depth = 0;
+    return 0;
+}
+
+BTreeKey btree_cursor_key(BTreeCursor *cursor)
+{
+    unsigned char top;
+
+    top = (unsigned char)(cursor->depth - 1);
+    return btree_key(cursor->path[top], cursor->index[top]);
+}
+
+BTreeValue btree_cursor_value(BTreeCursor *cursor)
+{
+    unsigned char top;
+
+    top = (unsigned char)(cursor->depth - 1);
+    return cursor->path[top]->values[cursor->index[top]];
+}
+
+unsigned int btree_range(BTree *tree, BTreeKey lo, BTreeKey hi, BTreeVisit visit, void *ctx)
+{
+    BTreeCursor cursor;
+    BTreeKey key;
+    unsigned int count;
+
+    count = 0;
+    if (BTREE_KEY_LESS(hi, lo) || !btree_cursor_seek(&cursor, tree, lo))
+        return 0;
+
+    do
+    {
+        key = btree_cursor_key(&cursor);
+        if (BTREE_KEY_LESS(hi, key))
+            break;
+
+        count++;
+        if (!visit(key, btree_cursor_value(&cursor), ctx))
+            break;
+    } while (btree_cursor_next(&cursor));
+
+    return count;
+}
@@ -2,7 +2,35 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+
+/* Index backend. The demo only needs point operations, so it runs on the
+ * hash index as well; build with -DDEMO_HASHIDX to use it.
+ */
+#ifdef DEMO_HASHIDX
+#include "hashidx.h"
+typedef HashIdx DemoIndex;
+#define demo_create hashidx_create
+#define demo_insert hashidx_insert
+#define demo_get hashidx_get
+#define demo_update hashidx_update
+#define demo_delete hashidx_delete
+#define demo_free hashidx_free
+#define demo_footprint hashidx_memory_usage
+#define DEMO_NAME "Hash index"
+#define DEMO_FOOTPRINT "Table bytes"
+#else
 #include "btree.h"
+typedef BTree DemoIndex;
+#define demo_create btree_create
+#define demo_insert btree_insert
+#define demo_get btree_get
+#define demo_update btree_update
+#define demo_delete btree_delete
+#define demo_free btree_free
+#define demo_footprint btree_node_count
+#define DEMO_NAME "B-tree"
+#define DEMO_FOOTPRINT "Node count"
+#endif
 
 /* Static arrays for JSON generation */
 static char *names[] = {"Alice", "Bob", "Charlie", "Diana", "Eve", "Frank"};
@@ -23,7 +51,7 @@ static unsigned int valid_key_count = 0;
 
 void main()
 {
-    BTree *tree;
+    DemoIndex *tree;
     void *value;
     unsigned int node_count;
     unsigned int unique_key_count;
@@ -54,7 +82,7 @@ void main()
     unsigned int runs_ok;
     unsigned char run_ok;
 
-    puts("=== B-tree Demo (stress runs) ===\n");
+    puts("=== " DEMO_NAME " Demo (stress runs) ===\n");
 
     stress_runs = 10; /* configurable */
     runs_ok = 0;
@@ -72,7 +100,7 @@ void main()
         srand((unsigned int)lrand());
 
         /* Create tree */
-        tree = btree_create();
+        tree = demo_create();
 
         if (!tree)
         {
@@ -90,7 +118,7 @@ void main()
         {
             seq_id = i;
             random_value = (int)((rand() << 1) | 1); /* Ensure non-zero value */
-            btree_insert(tree, seq_id, (void *)(unsigned int)random_value);
+            demo_insert(tree, seq_id, (void *)(unsigned int)random_value);
 
             /* Record valid key for update/delete selection */
             if (valid_key_count < KEY_LIST_MAX)
@@ -142,7 +170,7 @@ void main()
     {
         json_key = (unsigned int)((rand() & 0x7FFF) + 30000);
         json_keys[json_index] = json_key;
-        btree_insert(tree, json_key, (void *)json_ptrs[json_index]);
+        demo_insert(tree, json_key, (void *)json_ptrs[json_index]);
         printf("  Inserted JSON %u at key %u: %s\n", json_index + 1, json_key, json_ptrs[json_index]);
     }
 
@@ -165,7 +193,7 @@ void main()
         for (i = 0; i < get_count; i++)
         {
             get_key = valid_keys[rand() % valid_key_count];
-            value = btree_get(tree, get_key);
+            value = demo_get(tree, get_key);
 
             if (value != NULL)
             {
@@ -194,9 +222,9 @@ void main()
         {
             update_key = valid_keys[rand() % valid_key_count];
             update_value = (int)((rand() << 1) | 1); /* Ensure non-zero value */
-            if (btree_update(tree, update_key, (void *)(unsigned int)update_value))
+            if (demo_update(tree, update_key, (void *)(unsigned int)update_value))
             {
-                value = btree_get(tree, update_key);
+                value = demo_get(tree, update_key);
                 if (value != NULL && (int)(unsigned int)value == update_value)
                 {
                     updates_successful++;
@@ -213,7 +241,7 @@ void main()
     puts("Retrieving JSON strings...");
     for (json_index = 0; json_index < json_count; json_index++)
     {
-        value = btree_get(tree, json_keys[json_index]);
+        value = demo_get(tree, json_keys[json_index]);
         if (value != NULL)
             printf("Key %u (JSON %u): %s\n", json_keys[json_index], json_index + 1, (char *)value);
         else
@@ -240,7 +268,7 @@ void main()
         key_index = rand() % valid_key_count;
         delete_key = valid_keys[key_index];
 
-        if (btree_delete(tree, delete_key))
+        if (demo_delete(tree, delete_key))
         {
             deletes_attempted++;
             /* Remove from list immediately (regardless of verification) */
@@ -250,13 +278,13 @@ void main()
                 valid_key_count--;
             }
 
-            value = btree_get(tree, delete_key);
+            value = demo_get(tree, delete_key);
 
             if (value != NULL)
             {
                 /* Retry once if the key is still present (defensive) */
-                if (btree_delete(tree, delete_key))
-                    value = btree_get(tree, delete_key);
+                if (demo_delete(tree, delete_key))
+                    value = demo_get(tree, delete_key);
             }
 
             if (value == NULL)
@@ -275,9 +303,9 @@ void main()
     unique_key_count = (unsigned int)item_count;
     unique_key_count = (unsigned int)(unique_key_count - deletes_successful);
 
-    node_count = btree_node_count(tree);
+    node_count = demo_footprint(tree);
     printf("Unique key count: %u\n", unique_key_count);
-    printf("Node count: %u\n", node_count);
+    printf(DEMO_FOOTPRINT ": %u\n", node_count);
 
     putchar('\n');
     puts("Demo complete! xxx");
@@ -304,7 +332,7 @@ void main()
         runs_ok++;
 
     /* Cleanup */
-    btree_free(tree);
+    demo_free(tree);
     }
 
     /* Stress summary */
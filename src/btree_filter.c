@@ -0,0 +1,151 @@
+#include "btree_int.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if BTREE_FILTER
+
+/* Negative-lookup filter. Each key sets two bits: one from its own low
+ * bits folded with the high byte, which keeps runs of sequential keys on
+ * distinct bits, and one from the top bits of a 16-bit Fibonacci hash.
+ */
+
+#define FILTER_MAX_BYTES 8192
+#define FILTER_GOLDEN 40503U
+
+static const unsigned char filter_bit[8] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80};
+
+#define filter_h1(tree, h) (((h) ^ ((h) >> 8)) & (tree)->filter_mask)
+#define filter_h2(tree, h) ((((h) * FILTER_GOLDEN) & 0xFFFFU) >> (tree)->filter_shift)
+#define filter_set(tree, b) ((tree)->filter[(b) >> 3] |= filter_bit[(b) & 7])
+#define filter_get(tree, b) ((tree)->filter[(b) >> 3] & filter_bit[(b) & 7])
+
+void btree_filter_add(BTree *tree, BTreeKey key)
+{
+    unsigned int h;
+    unsigned int b;
+
+    h = BTREE_KEY_HASH(key);
+    b = filter_h1(tree, h);
+    filter_set(tree, b);
+    b = filter_h2(tree, h);
+    filter_set(tree, b);
+}
+
+/* Clear the filter and add every key still in the tree */
+static void filter_rebuild(BTree *tree)
+{
+    BTreeNode *path[BTREE_MAX_HEIGHT];
+    unsigned char next[BTREE_MAX_HEIGHT];
+    BTreeNode *node;
+    unsigned char top;
+    unsigned char i;
+
+    memset(tree->filter, 0, tree->filter_mask / 8 + 1);
+    tree->filter_stale = 0;
+
+    path[0] = tree->root;
+    next[0] = 0;
+    top = 0;
+
+    while (1)
+    {
+        node = path[top];
+
+        /* Add a node's keys the first time it is reached */
+        if (next[top] == 0)
+            for (i = 0; i < node->key_count; i++)
+                btree_filter_add(tree, btree_key(node, i));
+
+        if (node->is_leaf || next[top] > node->key_count || top + 1 >= BTREE_MAX_HEIGHT)
+        {
+            if (top == 0)
+                break;
+            top--;
+            continue;
+        }
+
+        path[top + 1] = node->children[next[top]];
+        next[top]++;
+        top++;
+        next[top] = 0;
+    }
+}
+
+unsigned char btree_filter_test(BTree *tree, BTreeKey key)
+{
+    unsigned int h;
+    unsigned int b;
+
+    /* Stale bits only cost false positives, so wait until they pile up */
+    if (tree->filter_stale > tree->size / 2)
+    {
+        filter_rebuild(tree);
+        tree->filter_rebuilds++;
+    }
+
+    tree->filter_checks++;
+    h = BTREE_KEY_HASH(key);
+    b = filter_h1(tree, h);
+    if (filter_get(tree, b))
+    {
+        b = filter_h2(tree, h);
+        if (filter_get(tree, b))
+            return 1;
+    }
+
+    tree->filter_rejects++;
+    return 0;
+}
+
+unsigned char btree_set_filter(BTree *tree, unsigned int filter_bytes)
+{
+    unsigned int bytes;
+    unsigned char shift;
+
+    if (!tree)
+        return 0;
+
+    free(tree->filter);
+    tree->filter = NULL;
+    tree->filter_checks = 0;
+    tree->filter_rejects = 0;
+    tree->filter_rebuilds = 0;
+    if (filter_bytes == 0)
+        return 1;
+
+    /* Round down to a power of two; h2 keeps the top log2(bits) bits */
+    if (filter_bytes > FILTER_MAX_BYTES)
+        filter_bytes = FILTER_MAX_BYTES;
+    bytes = 1;
+    shift = 13;
+    while (bytes * 2 <= filter_bytes)
+    {
+        bytes *= 2;
+        shift--;
+    }
+
+    tree->filter = (unsigned char *)malloc(bytes);
+    if (!tree->filter)
+        return 0;
+    tree->filter_mask = bytes * 8 - 1;
+    tree->filter_shift = shift;
+    if (tree->root)
+        filter_rebuild(tree);
+
+    return 1;
+}
+
+unsigned char btree_filter_stats(BTree *tree, BTreeFilterStats *stats)
+{
+    if (!tree || !tree->filter || !stats)
+        return 0;
+
+    stats->bytes = tree->filter_mask / 8 + 1;
+    stats->checks = tree->filter_checks;
+    stats->rejects = tree->filter_rejects;
+    stats->rebuilds = tree->filter_rebuilds;
+
+    return 1;
+}
+
+#endif
@@ -0,0 +1,141 @@
+#include "btree_int.h"
+#include <stdlib.h>
+
+/* Frozen index: a read-only copy of the tree's keys and values in two
+ * flat arrays in Eytzinger (BFS) order, 1-based, so entry k has its
+ * children at 2k and 2k+1. A lookup walks down with one comparison per
+ * level and no branch on its outcome, and the top levels of every search
+ * share the first few entries.
+ */
+
+/* Next entry in key order after k, 0 past the last */
+static unsigned int frozen_next(BTreeFrozen *frozen, unsigned int k)
+{
+    if (2 * k + 1 <= frozen->count)
+    {
+        /* Leftmost entry of the right subtree */
+        k = 2 * k + 1;
+        while (2 * k <= frozen->count)
+            k *= 2;
+        return k;
+    }
+
+    /* Climb out of right subtrees; the parent of a left child follows it */
+    while (k & 1)
+        k >>= 1;
+    return k >> 1;
+}
+
+/* First entry with a key >= key, 0 if there is none */
+static unsigned int frozen_seek(BTreeFrozen *frozen, BTreeKey key)
+{
+    unsigned int k;
+
+    k = 1;
+    while (k <= frozen->count)
+        k = 2 * k + (BTREE_KEY_LESS(frozen->keys[k], key) != 0);
+
+    /* The last left turn on the way down ends at the answer */
+    while (k & 1)
+        k >>= 1;
+    return k >> 1;
+}
+
+BTreeFrozen *btree_freeze(BTree *tree)
+{
+    BTreeFrozen *frozen;
+    BTreeCursor cursor;
+    BTreeNode *node;
+    unsigned int k;
+
+    if (!tree || !tree->root || tree->size > BTREE_FROZEN_MAX)
+        return NULL;
+
+    frozen = (BTreeFrozen *)malloc(sizeof(BTreeFrozen));
+    if (!frozen)
+        return NULL;
+
+    /* Entry 0 is unused so that the children of k are 2k and 2k+1 */
+    frozen->count = tree->size;
+    frozen->keys = (BTreeKey *)malloc((frozen->count + 1) * sizeof(BTreeKey));
+    frozen->values = (BTreeValue *)malloc((frozen->count + 1) * sizeof(BTreeValue));
+    if (!frozen->keys || !frozen->values)
+    {
+        btree_frozen_free(frozen);
+        return NULL;
+    }
+    if (frozen->count == 0)
+        return frozen;
+
+    /* Visit the tree in key order and the entries in the same order */
+    node = tree->root;
+    while (!node->is_leaf)
+        node = node->children[0];
+    btree_cursor_seek(&cursor, tree, btree_key(node, 0));
+
+    k = 1;
+    while (2 * k <= frozen->count)
+        k *= 2;
+    do
+    {
+        frozen->keys[k] = btree_cursor_key(&cursor);
+        frozen->values[k] = btree_cursor_value(&cursor);
+        k = frozen_next(frozen, k);
+    } while (k && btree_cursor_next(&cursor));
+
+    return frozen;
+}
+
+BTreeValue btree_frozen_get(BTreeFrozen *frozen, BTreeKey key)
+{
+    unsigned int k;
+
+    if (!frozen)
+        return BTREE_VALUE_NONE;
+
+    k = frozen_seek(frozen, key);
+    if (k && BTREE_KEY_EQ(key, frozen->keys[k]))
+        return frozen->values[k];
+
+    return BTREE_VALUE_NONE; /* Not found */
+}
+
+unsigned int btree_frozen_range(BTreeFrozen *frozen, BTreeKey lo, BTreeKey hi, BTreeVisit visit, void *ctx)
+{
+    unsigned int k;
+    unsigned int count;
+
+    count = 0;
+    if (!frozen || BTREE_KEY_LESS(hi, lo))
+        return 0;
+
+    for (k = frozen_seek(frozen, lo); k; k = frozen_next(frozen, k))
+    {
+        if (BTREE_KEY_LESS(hi, frozen->keys[k]))
+            break;
+
+        count++;
+        if (!visit(frozen->keys[k], frozen->values[k], ctx))
+            break;
+    }
+
+    return count;
+}
+
+unsigned int btree_frozen_size(BTreeFrozen *frozen)
+{
+    if (!frozen)
+        return 0;
+
+    return frozen->count;
+}
+
+void btree_frozen_free(BTreeFrozen *frozen)
+{
+    if (!frozen)
+        return;
+
+    free(frozen->keys);
+    free(frozen->values);
+    free(frozen);
+}
@@ -0,0 +1,116 @@
+#ifndef BTREE_INT_H
+#define BTREE_INT_H
+
+/* Helpers shared between the B-tree source files.
+ * Not part of the public API in btree.h.
+ */
+
+#include "btree.h"
+
+/* Read, write and copy key i of a node in either key layout */
+#if BTREE_BYTE_PLANES
+#define btree_key(node, i) \
+    ((BTreeKey)((node)->key_lo[i] | ((unsigned int)(node)->key_hi[i] << 8)))
+#define btree_key_set(node, i, key) \
+    ((node)->key_lo[i] = (unsigned char)(key), \
+     (node)->key_hi[i] = (unsigned char)((unsigned int)(key) >> 8))
+#define btree_key_copy(dst, di, src, si) \
+    ((dst)->key_lo[di] = (src)->key_lo[si], (dst)->key_hi[di] = (src)->key_hi[si])
+#else
+#define btree_key(node, i) ((node)->keys[i])
+#define btree_key_set(node, i, key) ((node)->keys[i] = (key))
+#define btree_key_copy(dst, di, src, si) ((dst)->keys[di] = (src)->keys[si])
+#endif
+
+/* Index of the first key >= key in node, or key_count if there is none */
+unsigned char btree_node_find(BTreeNode *node, BTreeKey key);
+
+/* Move keys and values i..key_count-1 up one slot (the node must have
+ * room) or i+1..key_count-1 down over slot i. key_count is unchanged.
+ */
+void btree_node_open(BTreeNode *node, unsigned char i);
+void btree_node_close(BTreeNode *node, unsigned char i);
+
+/* Copy n keys and values from slot si of src to slot di of another node */
+void btree_node_copy(BTreeNode *dst, unsigned char di, BTreeNode *src, unsigned char si, unsigned char n);
+
+/* BTREE_ASM links the ca65 kernels in btree_kernel.s in place of the C
+ * ones for the default tree. They scan linearly whatever BTREE_SEARCH
+ * says and need the 16-bit key layout; specialised trees keep the C
+ * kernels.
+ */
+#if defined(BTREE_ASM) && !defined(BTREE_PREFIX)
+#define BTREE_ASM_KERNELS 1
+#else
+#define BTREE_ASM_KERNELS 0
+#endif
+
+#if BTREE_ASM_KERNELS
+#if !defined(__CC65__) || BTREE_BYTE_PLANES
+#error "BTREE_ASM needs cc65 and the 16-bit key layout"
+#endif
+unsigned char __fastcall__ btree_node_find_asm(BTreeNode *node, BTreeKey key);
+void __fastcall__ btree_node_open_asm(BTreeNode *node, unsigned char i);
+void __fastcall__ btree_node_close_asm(BTreeNode *node, unsigned char i);
+void __fastcall__ btree_node_copy_asm(BTreeNode *dst, unsigned char di, BTreeNode *src, unsigned char si, unsigned char n);
+#define node_find(node, key) btree_node_find_asm(node, key)
+#define node_open(node, i) btree_node_open_asm(node, i)
+#define node_close(node, i) btree_node_close_asm(node, i)
+#define node_copy(dst, di, src, si, n) btree_node_copy_asm(dst, di, src, si, n)
+#else
+#define node_find(node, key) btree_node_find(node, key)
+#define node_open(node, i) btree_node_open(node, i)
+#define node_close(node, i) btree_node_close(node, i)
+#define node_copy(dst, di, src, si, n) btree_node_copy(dst, di, src, si, n)
+#endif
+
+/* Put key at position i of a leaf that has room */
+void btree_leaf_insert(BTreeNode *node, unsigned char i, BTreeKey key, BTreeValue value);
+
+/* Allocate a node from the tree's pool or the heap, NULL when out of memory */
+BTreeNode *btree_node_create(BTree *tree, unsigned char is_leaf);
+
+/* Release a single node */
+void btree_node_free(BTree *tree, BTreeNode *node);
+
+#if BTREE_SNAPSHOTS
+/* Replace the shared node at *slot with a private copy and return it, NULL
+ * when out of memory. The node holding slot must be private already.
+ */
+BTreeNode *btree_node_own(BTree *tree, BTreeNode **slot);
+#define node_own(tree, slot) ((*(slot))->refs ? btree_node_own(tree, slot) : *(slot))
+#else
+#define node_own(tree, slot) (*(slot))
+#endif
+
+/* Forget the finger leaf; call before moving keys between nodes */
+#define btree_finger_drop(tree) ((tree)->finger = NULL)
+
+#if BTREE_FILTER
+/* Set the filter bits of key; the caller checks that tree->filter is set */
+void btree_filter_add(BTree *tree, BTreeKey key);
+
+/* 0 when key is certainly not in the tree, 1 when it may be. Rebuilds a
+ * filter gone stale after deletes first.
+ */
+unsigned char btree_filter_test(BTree *tree, BTreeKey key);
+#endif
+
+#if BTREE_ORDER_STATS
+/* Keys in the subtree under node */
+unsigned int btree_node_total(BTreeNode *node);
+#endif
+
+/* Bring child i of node above BTREE_MIN_KEYS keys from its siblings,
+ * returns the index the child ends up at, or BTREE_NO_CHILD when a shared
+ * sibling could not be copied. The child is private on return.
+ */
+#define BTREE_NO_CHILD 0xFF
+unsigned char btree_node_top_up(BTree *tree, BTreeNode *node, unsigned char i);
+
+/* Release node and everything below it, returns the number of keys it
+ * held. Shared subtrees lose a reference instead of being freed.
+ */
+unsigned int btree_free_nodes(BTree *tree, BTreeNode *node);
+
+#endif
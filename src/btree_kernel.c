@@ -0,0 +1,114 @@
+#include "btree_int.h"
+
+/* In-node kernels: the key search and the key/value moves behind inserts,
+ * splits, merges and deletes. The tree code reaches them through the
+ * node_* macros in btree_int.h, which pick the ca65 versions from
+ * btree_kernel.s in BTREE_ASM builds. These C versions are always built,
+ * so the benchmark can check the two against each other.
+ */
+
+/* Index of the first key >= key, or key_count if there is none */
+unsigned char btree_node_find(BTreeNode *node, BTreeKey key)
+{
+#if (BTREE_SEARCH == BTREE_SEARCH_BINARY)
+    unsigned char lo;
+    unsigned char hi;
+    unsigned char mid;
+
+    lo = 0;
+    hi = node->key_count;
+    while (lo < hi)
+    {
+        mid = (unsigned char)((lo + hi) >> 1);
+        if (BTREE_KEY_LESS(btree_key(node, mid), key))
+            lo = (unsigned char)(mid + 1);
+        else
+            hi = mid;
+    }
+
+    return lo;
+#elif BTREE_BYTE_PLANES
+    unsigned char i;
+    unsigned char n;
+    unsigned char lo;
+    unsigned char hi;
+
+    /* Keys are sorted: skip the smaller high bytes, then the smaller low
+     * bytes under an equal high byte. Each test reads one byte plane.
+     */
+    lo = (unsigned char)key;
+    hi = (unsigned char)((unsigned int)key >> 8);
+    i = 0;
+    n = node->key_count;
+    while (i < n && node->key_hi[i] < hi)
+        i++;
+    while (i < n && node->key_hi[i] == hi && node->key_lo[i] < lo)
+        i++;
+
+    return i;
+#elif (BTREE_SEARCH == BTREE_SEARCH_UNROLLED)
+    unsigned char i;
+    unsigned char n;
+
+    i = 0;
+    n = node->key_count;
+    while ((unsigned char)(i + 4) <= n)
+    {
+        if (!BTREE_KEY_LESS(btree_key(node, i), key))
+            return i;
+        if (!BTREE_KEY_LESS(btree_key(node, i + 1), key))
+            return (unsigned char)(i + 1);
+        if (!BTREE_KEY_LESS(btree_key(node, i + 2), key))
+            return (unsigned char)(i + 2);
+        if (!BTREE_KEY_LESS(btree_key(node, i + 3), key))
+            return (unsigned char)(i + 3);
+        i += 4;
+    }
+    while (i < n && BTREE_KEY_LESS(btree_key(node, i), key))
+        i++;
+
+    return i;
+#else
+    unsigned char i;
+
+    i = 0;
+    while (i < node->key_count && BTREE_KEY_LESS(btree_key(node, i), key))
+        i++;
+
+    return i;
+#endif
+}
+
+void btree_node_open(BTreeNode *node, unsigned char i)
+{
+    unsigned char j;
+
+    for (j = node->key_count; j > i; j--)
+    {
+        btree_key_copy(node, j, node, j - 1);
+        node->values[j] = node->values[j - 1];
+    }
+}
+
+void btree_node_close(BTreeNode *node, unsigned char i)
+{
+    unsigned char last;
+
+    last = (unsigned char)(node->key_count - 1);
+    for (; i < last; i++)
+    {
+        btree_key_copy(node, i, node, i + 1);
+        node->values[i] = node->values[i + 1];
+    }
+}
+
+void btree_node_copy(BTreeNode *dst, unsigned char di, BTreeNode *src, unsigned char si, unsigned char n)
+{
+    for (; n > 0; n--)
+    {
+        btree_key_copy(dst, di, src, si);
+        dst->values[di] = src->values[si];
+        di++;
+        si++;
+    }
+}
@@ -0,0 +1,213 @@
+; ca65 versions of the B-tree kernels in btree_kernel.c, linked in place
+; of the C loops when the library is built with BTREE_ASM.
+; They assume the default node layout: key_count at offset 0, then
+; 16-bit keys and 16-bit values, no byte planes. Assemble with
+; --asm-define BTREE_MAX_CHILDREN=<order> when the order is not 10.
+
+.include "zeropage.inc"
+
+.import incsp2, incsp6
+.export _btree_node_find_asm, _btree_node_open_asm
+.export _btree_node_close_asm, _btree_node_copy_asm
+
+.ifndef BTREE_MAX_CHILDREN
+BTREE_MAX_CHILDREN = 10
+.endif
+
+MAX_KEYS = BTREE_MAX_CHILDREN - 1
+KEYS     = 2                    ; offsetof(BTreeNode, keys)
+VALUES   = KEYS + 2 * MAX_KEYS  ; offsetof(BTreeNode, values)
+
+; Every key and value must be reachable with an 8-bit Y offset
+.if VALUES + 2 * MAX_KEYS > 256
+.error "BTREE_MAX_CHILDREN is too large for the ca65 kernels"
+.endif
+
+.segment "CODE"
+
+; unsigned char __fastcall__ btree_node_find_asm(BTreeNode *node, unsigned int key)
+; Index of the first key >= key, or key_count. Linear scan that settles
+; most keys on the high byte alone.
+.proc _btree_node_find_asm
+        sta     tmp1            ; key low
+        stx     tmp2            ; key high
+        ldy     #1
+        lda     (sp),y
+        sta     ptr1+1
+        dey
+        lda     (sp),y
+        sta     ptr1
+        lda     (ptr1),y        ; key_count
+        asl     a
+        adc     #KEYS           ; carry is clear, key_count < 128
+        sta     tmp3            ; offset just past the last key
+        ldy     #KEYS
+loop:   cpy     tmp3
+        beq     done
+        iny
+        lda     (ptr1),y        ; high byte of the key at Y - 1
+        cmp     tmp2
+        bcc     next
+        bne     above
+        dey
+        lda     (ptr1),y        ; low byte
+        cmp     tmp1
+        bcs     done
+        iny
+next:   iny
+        bne     loop            ; always, offsets stay below 256
+above:  dey
+done:   tya
+        sec
+        sbc     #KEYS
+        lsr     a
+        ldx     #0
+        jmp     incsp2
+.endproc
+
+; Point ptr1 at the node on top of the C stack and ptr2 two bytes above
+; it, one slot further along both the key and the value array. Y = 0.
+.proc node_ptrs
+        ldy     #1
+        lda     (sp),y
+        sta     ptr1+1
+        sta     ptr2+1
+        dey
+        lda     (sp),y
+        sta     ptr1
+        clc
+        adc     #2
+        sta     ptr2
+        bcc     done
+        inc     ptr2+1
+done:   rts
+.endproc
+
+; void __fastcall__ btree_node_open_asm(BTreeNode *node, unsigned char i)
+; Move keys and values i..key_count-1 up one slot. key_count is unchanged.
+.proc _btree_node_open_asm
+        asl     a
+        sta     tmp1            ; 2 * i
+        jsr     node_ptrs
+        lda     (ptr1),y        ; key_count
+        asl     a
+        cmp     tmp1
+        beq     done            ; nothing at or above i
+        sta     tmp2            ; 2 * key_count
+        lda     tmp1
+        clc
+        adc     #KEYS - 1
+        sta     tmp3            ; stop below the key at i
+        lda     tmp2
+        adc     #KEYS - 1       ; carry is clear
+        tay
+kloop:  lda     (ptr1),y        ; copy downwards, the areas overlap
+        sta     (ptr2),y
+        dey
+        cpy     tmp3
+        bne     kloop
+        lda     tmp1
+        clc
+        adc     #VALUES - 1
+        sta     tmp3
+        lda     tmp2
+        adc     #VALUES - 1
+        tay
+vloop:  lda     (ptr1),y
+        sta     (ptr2),y
+        dey
+        cpy     tmp3
+        bne     vloop
+done:   jmp     incsp2
+.endproc
+
+; void __fastcall__ btree_node_close_asm(BTreeNode *node, unsigned char i)
+; Move keys and values i+1..key_count-1 down one slot over slot i.
+; key_count is unchanged.
+.proc _btree_node_close_asm
+        asl     a
+        sta     tmp1            ; 2 * i
+        jsr     node_ptrs
+        lda     (ptr1),y        ; key_count
+        asl     a
+        sec
+        sbc     #2              ; 2 * (key_count - 1)
+        cmp     tmp1
+        beq     done            ; i is the last key
+        sta     tmp2
+        clc
+        adc     #KEYS
+        sta     tmp3            ; stop at the last key
+        lda     tmp1
+        adc     #KEYS           ; carry is clear
+        tay
+kloop:  lda     (ptr2),y        ; copy upwards, the areas overlap
+        sta     (ptr1),y
+        iny
+        cpy     tmp3
+        bne     kloop
+        lda     tmp2
+        clc
+        adc     #VALUES
+        sta     tmp3
+        lda     tmp1
+        adc     #VALUES
+        tay
+vloop:  lda     (ptr2),y
+        sta     (ptr1),y
+        iny
+        cpy     tmp3
+        bne     vloop
+done:   jmp     incsp2
+.endproc
+
+; void __fastcall__ btree_node_copy_asm(BTreeNode *dst, unsigned char di,
+;                                       BTreeNode *src, unsigned char si,
+;                                       unsigned char n)
+; Copy n keys and values from slot si of src to slot di of dst. The nodes
+; must differ.
+.proc _btree_node_copy_asm
+        asl     a
+        beq     done            ; n == 0
+        sta     tmp1            ; 2 * n
+        ldy     #0
+        lda     (sp),y          ; si
+        asl     a
+        iny
+        adc     (sp),y          ; carry is clear, si < 128
+        sta     ptr1            ; ptr1 = src + 2 * si
+        iny
+        lda     (sp),y
+        adc     #0
+        sta     ptr1+1
+        iny
+        lda     (sp),y          ; di
+        asl     a
+        iny
+        adc     (sp),y
+        sta     ptr2            ; ptr2 = dst + 2 * di
+        iny
+        lda     (sp),y
+        adc     #0
+        sta     ptr2+1
+        lda     tmp1
+        adc     #KEYS           ; carry is clear
+        sta     tmp2
+        ldy     #KEYS
+kloop:  lda     (ptr1),y
+        sta     (ptr2),y
+        iny
+        cpy     tmp2
+        bne     kloop
+        lda     tmp1
+        clc
+        adc     #VALUES
+        sta     tmp2
+        ldy     #VALUES
+vloop:  lda     (ptr1),y
+        sta     (ptr2),y
+        iny
+        cpy     tmp2
+        bne     vloop
+done:   jmp     incsp6
+.endproc
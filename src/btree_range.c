@@ -0,0 +1,272 @@
+#include "btree_int.h"
+#include <stdlib.h>
+
+/* Range delete. Subtrees that lie wholly inside the range are released
+ * without looking at their keys, and only the two paths that lead to the
+ * ends of the range are trimmed. The last key of the range stays behind
+ * as the separator between those paths while they are cut; two top-up
+ * descents refill them and a plain btree_delete of that key finishes.
+ */
+
+/* Cut the range out of child ci of parent, which holds either keys
+ * >= key (right == 0, the child left of the kept separator) or keys
+ * <= key (right == 1). Only the path to the cut is visited; subtrees past
+ * it are released whole. Returns the number of keys removed.
+ */
+static unsigned int range_trim(BTree *tree, BTreeNode *parent, unsigned char ci, BTreeKey key, unsigned char right)
+{
+    BTreeNode *spine[BTREE_MAX_HEIGHT];
+    BTreeNode *node;
+    unsigned char depth;
+    unsigned char i;
+    unsigned char j;
+    unsigned int removed;
+
+    removed = 0;
+    depth = 0;
+    node = parent->children[ci];
+    while (1)
+    {
+        i = node_find(node, key);
+        if (right)
+        {
+            if (i < node->key_count && BTREE_KEY_EQ(key, btree_key(node, i)))
+                i++;
+
+            /* Drop keys 0..i-1 and the subtrees left of child i */
+            removed += i;
+            if (!node->is_leaf)
+            {
+                for (j = 0; j < i; j++)
+                    removed += btree_free_nodes(tree, node->children[j]);
+                for (j = i; j <= node->key_count; j++)
+                {
+                    node->children[j - i] = node->children[j];
+#if BTREE_ORDER_STATS
+                    node->counts[j - i] = node->counts[j];
+#endif
+                }
+            }
+            for (j = i; j < node->key_count; j++)
+            {
+                btree_key_copy(node, j - i, node, j);
+                node->values[j - i] = node->values[j];
+            }
+            node->key_count = (unsigned char)(node->key_count - i);
+            i = 0;
+        }
+        else
+        {
+            /* Drop keys i.. and the subtrees right of child i */
+            removed += node->key_count - i;
+            if (!node->is_leaf)
+                for (j = i + 1; j <= node->key_count; j++)
+                    removed += btree_free_nodes(tree, node->children[j]);
+            node->key_count = i;
+        }
+
+        if (node->is_leaf)
+            break;
+        spine[depth++] = node;
+        node = node->children[i];
+    }
+
+#if BTREE_ORDER_STATS
+    /* Only the counts along the cut path changed; redo them bottom-up */
+    while (depth > 0)
+    {
+        node = spine[--depth];
+        i = right ? 0 : node->key_count;
+        node->counts[i] = btree_node_total(node->children[i]);
+    }
+    parent->counts[ci] = btree_node_total(parent->children[ci]);
+#endif
+
+    return removed;
+}
+
+#if BTREE_SNAPSHOTS
+/* Copy the nearest node beside child i of node on its level, to the left
+ * or right, into *side. On entry *side is the node beside node on that
+ * side, NULL at the edge of the tree. Returns 0 when out of memory.
+ */
+static unsigned char range_own_beside(BTree *tree, BTreeNode *node, unsigned char i, BTreeNode **side, unsigned char right)
+{
+    BTreeNode **slot;
+
+    if (right ? i < node->key_count : i > 0)
+        slot = &node->children[right ? i + 1 : i - 1];
+    else if (*side)
+        slot = &(*side)->children[right ? 0 : (*side)->key_count];
+    else
+        slot = NULL;
+
+    *side = slot ? node_own(tree, slot) : NULL;
+    return !slot || *side;
+}
+
+/* Copy the shared nodes range_trim() will cut, from child i of node down,
+ * and beside them on the far side from the cut the nodes the refill may
+ * borrow from or merge with; side is the one beside node. With those
+ * private the refill never needs memory. Returns 0 when out of memory.
+ */
+static unsigned char range_own(BTree *tree, BTreeNode *node, unsigned char i, BTreeNode *side, BTreeKey key, unsigned char right)
+{
+    while (1)
+    {
+        if (!range_own_beside(tree, node, i, &side, right))
+            return 0;
+        node = node_own(tree, &node->children[i]);
+        if (!node)
+            return 0;
+        if (node->is_leaf)
+            return 1;
+
+        i = node_find(node, key);
+        if (right && i < node->key_count && BTREE_KEY_EQ(key, btree_key(node, i)))
+            i++;
+    }
+}
+#endif
+
+/* Walk towards key topping up every child on the way, as btree_delete
+ * does. At the node holding key, right picks the subtree after it.
+ */
+static void range_refill(BTree *tree, BTreeKey key, unsigned char right)
+{
+    BTreeNode *node;
+    BTreeNode *old_root;
+    unsigned char i;
+
+    node = tree->root;
+    while (!node->is_leaf)
+    {
+        i = node_find(node, key);
+        if (right && i < node->key_count && BTREE_KEY_EQ(key, btree_key(node, i)))
+            i++;
+        i = btree_node_top_up(tree, node, i);
+        if (i == BTREE_NO_CHILD)
+            break;
+        node = node->children[i];
+    }
+
+    /* Merges below the root may have left it without keys */
+    while (!tree->root->is_leaf && tree->root->key_count == 0)
+    {
+        old_root = tree->root;
+        tree->root = old_root->children[0];
+        btree_node_free(tree, old_root);
+    }
+}
+
+unsigned int btree_delete_range(BTree *tree, BTreeKey lo, BTreeKey hi)
+{
+    BTreeNode *node;
+    unsigned char a;
+    unsigned char b;
+    unsigned char n;
+    unsigned char j;
+    unsigned int removed;
+    BTreeKey kept;
+#if BTREE_ORDER_STATS
+    BTreeNode *step;
+#endif
+#if BTREE_SNAPSHOTS
+    BTreeNode *left;
+    BTreeNode *right;
+#endif
+
+    if (!tree || !tree->root || BTREE_KEY_LESS(hi, lo))
+        return 0;
+
+    /* Find the highest node with a key in the range: keys a..b-1. Shared
+     * nodes are copied on the way down, with their neighbours, so that
+     * running out of memory leaves the tree as it was.
+     */
+    node = node_own(tree, &tree->root);
+#if BTREE_SNAPSHOTS
+    left = NULL;
+    right = NULL;
+#endif
+    while (node)
+    {
+        a = node_find(node, lo);
+        b = node_find(node, hi);
+        if (b < node->key_count && BTREE_KEY_EQ(hi, btree_key(node, b)))
+            b++;
+        if (a < b)
+            break;
+        if (node->is_leaf)
+            return 0;
+#if BTREE_SNAPSHOTS
+        if (!range_own_beside(tree, node, a, &left, 0) || !range_own_beside(tree, node, a, &right, 1))
+            return 0;
+#endif
+        node = node_own(tree, &node->children[a]);
+    }
+    if (!node)
+        return 0;
+
+#if BTREE_SNAPSHOTS
+    if (!node->is_leaf &&
+        (!range_own(tree, node, a, left, lo, 0) || !range_own(tree, node, b, right, hi, 1)))
+        return 0;
+#endif
+
+    btree_finger_drop(tree);
+
+    /* Keep key b-1 as the separator; the keys before it in the range go,
+     * and so do the subtrees between them, which lie wholly inside
+     */
+    kept = btree_key(node, b - 1);
+    n = (unsigned char)(b - a - 1);
+    removed = n;
+    if (!node->is_leaf)
+    {
+        for (j = a + 1; j < b; j++)
+            removed += btree_free_nodes(tree, node->children[j]);
+        for (j = b; j <= node->key_count; j++)
+        {
+            node->children[j - n] = node->children[j];
+#if BTREE_ORDER_STATS
+            node->counts[j - n] = node->counts[j];
+#endif
+        }
+    }
+    for (j = b - 1; j < node->key_count; j++)
+    {
+        btree_key_copy(node, j - n, node, j);
+        node->values[j - n] = node->values[j];
+    }
+    node->key_count = (unsigned char)(node->key_count - n);
+
+    /* The children either side of the separator hold the two ends */
+    if (!node->is_leaf)
+    {
+        removed += range_trim(tree, node, a, lo, 0);
+        removed += range_trim(tree, node, (unsigned char)(a + 1), hi, 1);
+    }
+
+#if BTREE_ORDER_STATS
+    /* The path down to node followed lo */
+    for (step = tree->root; step != node; step = step->children[j])
+    {
+        j = node_find(step, lo);
+        step->counts[j] -= removed;
+    }
+#endif
+    tree->size -= removed;
+#if BTREE_FILTER
+    tree->filter_stale += removed;
+#endif
+
+    /* The cut paths may be far below the minimum. Refill both sides of
+     * the separator, then delete it, which tops up its own path again.
+     */
+    if (!node->is_leaf)
+    {
+        range_refill(tree, kept, 0);
+        range_refill(tree, kept, 1);
+    }
+    return removed + btree_delete(tree, kept);
+}
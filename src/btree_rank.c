@@ -0,0 +1,76 @@
+#include "btree_int.h"
+
+#if BTREE_ORDER_STATS
+
+/* Order statistics from the per-child subtree counts of internal nodes.
+ * Both calls follow a single root-to-leaf path.
+ */
+
+unsigned char btree_select(BTree *tree, unsigned int k, BTreeKey *key)
+{
+    BTreeNode *node;
+    unsigned char i;
+
+    if (!tree || !tree->root || k >= tree->size)
+        return 0;
+
+    node = tree->root;
+    while (!node->is_leaf)
+    {
+        /* Skip whole subtrees and the separators between them */
+        for (i = 0; k >= node->counts[i]; i++)
+        {
+            k -= node->counts[i];
+            if (k == 0)
+            {
+                if (key)
+                    *key = btree_key(node, i);
+                return 1;
+            }
+            k--;
+        }
+        node = node->children[i];
+    }
+
+    if (key)
+        *key = btree_key(node, k);
+    return 1;
+}
+
+unsigned int btree_rank(BTree *tree, BTreeKey key)
+{
+    BTreeNode *node;
+    unsigned int rank;
+    unsigned char i;
+    unsigned char j;
+
+    if (!tree || !tree->root)
+        return 0;
+
+    rank = 0;
+    node = tree->root;
+    while (1)
+    {
+        i = node_find(node, key);
+        rank += i;
+        if (node->is_leaf)
+            break;
+
+        /* Everything under children[0..i-1] is smaller, and children[i]
+         * too when key is the separator at i
+         */
+        for (j = 0; j < i; j++)
+            rank += node->counts[j];
+        if (i < node->key_count && BTREE_KEY_EQ(key, btree_key(node, i)))
+        {
+            rank += node->counts[i];
+            break;
+        }
+
+        node = node->children[i];
+    }
+
+    return rank;
+}
+
+#endif
@@ -0,0 +1,54 @@
+#include "pbtree.h"
+#include <stddef.h>
+
+/* Saving walks the RAM tree in key order with a cursor and streams the
+ * keys into pbtree_build(), so the page file comes out packed no matter
+ * how the RAM tree was shaped.
+ */
+
+typedef struct
+{
+    BTreeCursor cursor;
+    unsigned char more;        /* Cursor still positioned on a key */
+} SaveSource;
+
+static unsigned char save_next(unsigned int *key, unsigned int *value, void *ctx)
+{
+    SaveSource *source;
+
+    source = (SaveSource *)ctx;
+    if (!source->more)
+        return 0;
+
+    *key = btree_cursor_key(&source->cursor);
+    *value = (unsigned int)btree_cursor_value(&source->cursor);
+    source->more = btree_cursor_next(&source->cursor);
+    return 1;
+}
+
+unsigned char btree_save(BTree *tree, const char *path)
+{
+    PBTree *file;
+    SaveSource source;
+    unsigned char ok;
+
+    if (!tree || !path)
+        return 0;
+
+    file = pbtree_create_file(path);
+    if (!file)
+        return 0;
+
+    source.more = btree_cursor_seek(&source.cursor, tree, 0);
+    ok = pbtree_build(file, btree_size(tree), save_next, &source);
+    if (!pbtree_sync(file))
+        ok = 0;
+    pbtree_free(file);
+
+    return ok;
+}
+
+PBTree *btree_open(const char *path)
+{
+    return pbtree_open(path);
+}
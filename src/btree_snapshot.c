@@ -0,0 +1,67 @@
+#include "btree_int.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if BTREE_SNAPSHOTS
+
+/* Copy-on-write snapshots. A snapshot is a second tree on the same root.
+ * Every node counts the parents beyond the first that point at it, tree
+ * roots included, and every write path copies the shared nodes it is
+ * about to change from the root down, so each tree only ever changes
+ * nodes it owns alone. btree_free_nodes() drops a reference from a shared
+ * subtree instead of freeing it.
+ */
+
+BTree *btree_snapshot(BTree *tree)
+{
+    BTree *snapshot;
+
+    /* Pool nodes would outlive neither tree's pool */
+    if (!tree || !tree->root || tree->pool || tree->root->refs == 0xFF)
+        return NULL;
+
+    snapshot = (BTree *)malloc(sizeof(BTree));
+    if (!snapshot)
+        return NULL;
+
+    *snapshot = *tree;
+    snapshot->finger_hits = 0;
+    snapshot->finger_misses = 0;
+#if BTREE_FILTER
+    snapshot->filter = NULL;
+    snapshot->filter_stale = 0;
+#endif
+
+    /* A finger leaf must sit on a path no other tree shares */
+    btree_finger_drop(snapshot);
+    btree_finger_drop(tree);
+
+    tree->root->refs++;
+    return snapshot;
+}
+
+BTreeNode *btree_node_own(BTree *tree, BTreeNode **slot)
+{
+    BTreeNode *node;
+    BTreeNode *copy;
+    unsigned char i;
+
+    node = *slot;
+    copy = btree_node_create(tree, node->is_leaf);
+    if (!copy)
+        return NULL;
+
+    memcpy(copy, node, node->is_leaf ? BTREE_LEAF_SIZE : BTREE_NODE_SIZE);
+    copy->refs = 0;
+
+    /* The copy is one more parent of each child */
+    if (!node->is_leaf)
+        for (i = 0; i <= node->key_count; i++)
+            node->children[i]->refs++;
+
+    node->refs--;
+    *slot = copy;
+    return copy;
+}
+
+#endif
@@ -0,0 +1,99 @@
+/* Name mapping for specialised B-trees, included by btree.h when
+ * BTREE_PREFIX is defined. Every public and internal btree_* name and
+ * every BTree* type is renamed to BTREE_PREFIX_<name>, so btree.c and its
+ * companions compile unchanged into a second tree with its own key and
+ * value types. Node order, search strategy and BTREE_ORDER_STATS are
+ * shared with the default tree; the value arena is not specialised.
+ *
+ * A specialisation header sets the parameters, includes btree.h and
+ * then btree_spec_end.h, which removes them again:
+ *
+ *   #include "btree.h"
+ *   #define BTREE_PREFIX btree_u8
+ *   #define BTREE_KEY_T unsigned char
+ *   #define BTREE_VALUE_T int
+ *   #define BTREE_VALUE_NONE (-32767 - 1)
+ *   #include "btree.h"
+ *   #include "btree_spec_end.h"
+ *
+ * The implementation file defines BTREE_SPEC_IMPL, includes that header
+ * (which then keeps the parameters) and includes btree.c, btree_kernel.c,
+ * btree_cursor.c, btree_bulk.c, btree_rank.c, btree_range.c,
+ * btree_filter.c, btree_freeze.c, btree_snapshot.c and btree_batch.c.
+ * See btree_u8.h and btree_u8.c.
+ */
+
+#define BTREE_NAME_CAT2(prefix, name) prefix##_##name
+#define BTREE_NAME_CAT(prefix, name) BTREE_NAME_CAT2(prefix, name)
+#define BTREE_NAME(name) BTREE_NAME_CAT(BTREE_PREFIX, name)
+
+/* Types */
+#define BTreeKey BTREE_NAME(Key)
+#define BTreeValue BTREE_NAME(Value)
+#define BTreeLeaf BTREE_NAME(Leaf)
+#define BTreeNode BTREE_NAME(Node)
+#define BTreePool BTREE_NAME(Pool)
+#define BTreePoolStats BTREE_NAME(PoolStats)
+#define BTreeFingerStats BTREE_NAME(FingerStats)
+#define BTreeFilterStats BTREE_NAME(FilterStats)
+#define BTree BTREE_NAME(Tree)
+#define BTreeCursor BTREE_NAME(Cursor)
+#define BTreeVisit BTREE_NAME(Visit)
+#define BTreeUpsert BTREE_NAME(Upsert)
+#define BTreeFrozen BTREE_NAME(Frozen)
+
+/* Public API */
+#define btree_create BTREE_NAME(create)
+#define btree_create_pool BTREE_NAME(create_pool)
+#define btree_pool_stats BTREE_NAME(pool_stats)
+#define btree_set_split_policy BTREE_NAME(set_split_policy)
+#define btree_set_finger BTREE_NAME(set_finger)
+#define btree_finger_stats BTREE_NAME(finger_stats)
+#define btree_set_filter BTREE_NAME(set_filter)
+#define btree_filter_stats BTREE_NAME(filter_stats)
+#define btree_insert BTREE_NAME(insert)
+#define btree_insert_many BTREE_NAME(insert_many)
+#define btree_bulk_load BTREE_NAME(bulk_load)
+#define btree_get BTREE_NAME(get)
+#define btree_get_many BTREE_NAME(get_many)
+#define btree_update BTREE_NAME(update)
+#define btree_get_slot BTREE_NAME(get_slot)
+#define btree_upsert BTREE_NAME(upsert)
+#define btree_delete BTREE_NAME(delete)
+#define btree_delete_range BTREE_NAME(delete_range)
+#define btree_cursor_seek BTREE_NAME(cursor_seek)
+#define btree_cursor_next BTREE_NAME(cursor_next)
+#define btree_cursor_prev BTREE_NAME(cursor_prev)
+#define btree_cursor_key BTREE_NAME(cursor_key)
+#define btree_cursor_value BTREE_NAME(cursor_value)
+#define btree_range BTREE_NAME(range)
+#define btree_size BTREE_NAME(size)
+#define btree_freeze BTREE_NAME(freeze)
+#define btree_frozen_get BTREE_NAME(frozen_get)
+#define btree_frozen_range BTREE_NAME(frozen_range)
+#define btree_frozen_size BTREE_NAME(frozen_size)
+#define btree_frozen_free BTREE_NAME(frozen_free)
+#define btree_snapshot BTREE_NAME(snapshot)
+#define btree_select BTREE_NAME(select)
+#define btree_rank BTREE_NAME(rank)
+#define btree_print BTREE_NAME(print)
+#define btree_node_count BTREE_NAME(node_count)
+#define btree_leaf_count BTREE_NAME(leaf_count)
+#define btree_memory_usage BTREE_NAME(memory_usage)
+#define btree_clear BTREE_NAME(clear)
+#define btree_free BTREE_NAME(free)
+
+/* Helpers from btree_int.h */
+#define btree_node_find BTREE_NAME(node_find)
+#define btree_node_open BTREE_NAME(node_open)
+#define btree_node_close BTREE_NAME(node_close)
+#define btree_node_copy BTREE_NAME(node_copy)
+#define btree_leaf_insert BTREE_NAME(leaf_insert)
+#define btree_node_create BTREE_NAME(node_create)
+#define btree_node_free BTREE_NAME(node_free)
+#define btree_node_total BTREE_NAME(node_total)
+#define btree_node_top_up BTREE_NAME(node_top_up)
+#define btree_node_own BTREE_NAME(node_own)
+#define btree_filter_add BTREE_NAME(filter_add)
+#define btree_filter_test BTREE_NAME(filter_test)
+#define btree_free_nodes BTREE_NAME(free_nodes)
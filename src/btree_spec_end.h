@@ -0,0 +1,84 @@
+/* Ends a specialisation started by btree_spec.h: removes the name mapping
+ * and the type parameters, so later code sees the default btree_* names.
+ */
+
+#undef BTREE_NAME_CAT2
+#undef BTREE_NAME_CAT
+#undef BTREE_NAME
+
+#undef BTreeKey
+#undef BTreeValue
+#undef BTreeLeaf
+#undef BTreeNode
+#undef BTreePool
+#undef BTreePoolStats
+#undef BTreeFingerStats
+#undef BTreeFilterStats
+#undef BTree
+#undef BTreeCursor
+#undef BTreeVisit
+#undef BTreeUpsert
+#undef BTreeFrozen
+
+#undef btree_create
+#undef btree_create_pool
+#undef btree_pool_stats
+#undef btree_set_split_policy
+#undef btree_set_finger
+#undef btree_finger_stats
+#undef btree_set_filter
+#undef btree_filter_stats
+#undef btree_insert
+#undef btree_insert_many
+#undef btree_bulk_load
+#undef btree_get
+#undef btree_get_many
+#undef btree_update
+#undef btree_get_slot
+#undef btree_upsert
+#undef btree_delete
+#undef btree_delete_range
+#undef btree_cursor_seek
+#undef btree_cursor_next
+#undef btree_cursor_prev
+#undef btree_cursor_key
+#undef btree_cursor_value
+#undef btree_range
+#undef btree_size
+#undef btree_freeze
+#undef btree_frozen_get
+#undef btree_frozen_range
+#undef btree_frozen_size
+#undef btree_frozen_free
+#undef btree_snapshot
+#undef btree_select
+#undef btree_rank
+#undef btree_print
+#undef btree_node_count
+#undef btree_leaf_count
+#undef btree_memory_usage
+#undef btree_clear
+#undef btree_free
+
+#undef btree_node_find
+#undef btree_node_open
+#undef btree_node_close
+#undef btree_node_copy
+#undef btree_leaf_insert
+#undef btree_node_create
+#undef btree_node_free
+#undef btree_node_total
+#undef btree_node_top_up
+#undef btree_node_own
+#undef btree_filter_add
+#undef btree_filter_test
+#undef btree_free_nodes
+
+#undef BTREE_PREFIX
+#undef BTREE_SPEC_BODY
+#undef BTREE_KEY_T
+#undef BTREE_VALUE_T
+#undef BTREE_VALUE_NONE
+#undef BTREE_KEY_LESS
+#undef BTREE_KEY_EQ
+#undef BTREE_KEY_HASH
@@ -0,0 +1,17 @@
+/* The btree_u8 specialisation: the generic tree code compiled once more
+ * with the types and names from btree_u8.h.
+ */
+
+#define BTREE_SPEC_IMPL
+#include "btree_u8.h"
+
+#include "btree.c"
+#include "btree_kernel.c"
+#include "btree_cursor.c"
+#include "btree_bulk.c"
+#include "btree_rank.c"
+#include "btree_range.c"
+#include "btree_filter.c"
+#include "btree_freeze.c"
+#include "btree_snapshot.c"
+#include "btree_batch.c"
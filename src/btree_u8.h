@@ -0,0 +1,35 @@
+#ifndef BTREE_U8_H
+#define BTREE_U8_H
+
+/* B-tree specialised for 8-bit keys and 16-bit int values.
+ * Same API as btree.h with btree_u8_ names and btree_u8_Tree/_Node/
+ * _Cursor types. Keys 0..255 take a byte each and values are stored
+ * directly instead of being cast to void *. btree_u8_get() returns
+ * BTREE_U8_NONE for a missing key.
+ */
+
+#include "btree.h"
+
+#define BTREE_U8_NONE (-32767 - 1)
+
+#undef BTREE_KEY_T
+#undef BTREE_VALUE_T
+#undef BTREE_VALUE_NONE
+#undef BTREE_KEY_LESS
+#undef BTREE_KEY_EQ
+
+#define BTREE_PREFIX btree_u8
+#define BTREE_KEY_T unsigned char
+#define BTREE_VALUE_T int
+#define BTREE_VALUE_NONE BTREE_U8_NONE
+#define BTREE_KEY_LESS(a, b) ((a) < (b))
+#define BTREE_KEY_EQ(a, b) ((a) == (b))
+
+#include "btree.h"
+
+/* btree_u8.c keeps the mapping to compile the tree code */
+#ifndef BTREE_SPEC_IMPL
+#include "btree_spec_end.h"
+#endif
+
+#endif
@@ -0,0 +1,240 @@
+#include "hashidx.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Fibonacci hashing: the top bits of key * 2^16/phi, kept to 16 bits so
+ * the host and cc65 builds agree
+ */
+#define HASHIDX_GOLDEN 40503U
+#define hashidx_home(index, key) \
+    ((unsigned int)((((key) * HASHIDX_GOLDEN) & 0xFFFFU) >> (index)->shift))
+
+#define HASHIDX_SLOT_BYTES (sizeof(unsigned int) + sizeof(void *) + 1)
+
+/* Give index an empty table of slots slots, returns 0 if out of memory */
+static unsigned char hashidx_alloc(HashIdx *index, unsigned int slots)
+{
+    unsigned char *block;
+    unsigned int bits;
+
+    block = (unsigned char *)malloc(slots * HASHIDX_SLOT_BYTES);
+    if (!block)
+        return 0;
+
+    index->keys = (unsigned int *)block;
+    index->values = (void **)(block + slots * sizeof(unsigned int));
+    index->used = block + slots * (sizeof(unsigned int) + sizeof(void *));
+    memset(index->used, 0, slots);
+    index->mask = slots - 1;
+
+    for (bits = 0; (1U << bits) < slots; bits++)
+        ;
+    index->shift = (unsigned char)(16 - bits);
+
+    return 1;
+}
+
+/* Move every entry into a table twice the size */
+static unsigned char hashidx_grow(HashIdx *index)
+{
+    HashIdx old;
+    unsigned int i;
+    unsigned int j;
+
+    if (index->mask + 1 >= HASHIDX_MAX_SLOTS)
+        return 0;
+
+    old = *index;
+    if (!hashidx_alloc(index, (old.mask + 1) * 2))
+        return 0;
+
+    for (i = 0; i <= old.mask; i++)
+    {
+        if (!old.used[i])
+            continue;
+        j = hashidx_home(index, old.keys[i]);
+        while (index->used[j])
+            j = (j + 1) & index->mask;
+        index->keys[j] = old.keys[i];
+        index->values[j] = old.values[i];
+        index->used[j] = 1;
+    }
+
+    free(old.keys);
+    return 1;
+}
+
+/* Slot holding key, or the empty slot that ends its probe run */
+static unsigned int hashidx_find(HashIdx *index, unsigned int key)
+{
+    unsigned int i;
+
+    i = hashidx_home(index, key);
+    while (index->used[i] && index->keys[i] != key)
+        i = (i + 1) & index->mask;
+
+    return i;
+}
+
+HashIdx *hashidx_create(void)
+{
+    HashIdx *index;
+
+    index = (HashIdx *)malloc(sizeof(HashIdx));
+    if (!index)
+        return NULL;
+
+    index->size = 0;
+    index->failures = 0;
+    if (!hashidx_alloc(index, HASHIDX_MIN_SLOTS))
+    {
+        free(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+void hashidx_insert(HashIdx *index, unsigned int key, void *value)
+{
+    unsigned int i;
+
+    if (!index)
+        return;
+
+    i = hashidx_find(index, key);
+    if (index->used[i])
+    {
+        index->values[i] = value;
+        return;
+    }
+
+    /* Keep the load at or below 3/4 */
+    if ((index->size + 1) * 4UL > (index->mask + 1) * 3UL)
+    {
+        if (!hashidx_grow(index))
+        {
+            index->failures++;
+            return;
+        }
+        i = hashidx_find(index, key);
+    }
+
+    index->keys[i] = key;
+    index->values[i] = value;
+    index->used[i] = 1;
+    index->size++;
+}
+
+void *hashidx_get(HashIdx *index, unsigned int key)
+{
+    unsigned int i;
+
+    if (!index)
+        return NULL;
+
+    i = hashidx_find(index, key);
+    if (index->used[i])
+        return index->values[i];
+
+    return NULL; /* Not found */
+}
+
+unsigned char hashidx_update(HashIdx *index, unsigned int key, void *new_value)
+{
+    unsigned int i;
+
+    if (!index)
+        return 0;
+
+    i = hashidx_find(index, key);
+    if (!index->used[i])
+        return 0;
+
+    index->values[i] = new_value;
+    return 1;
+}
+
+unsigned char hashidx_delete(HashIdx *index, unsigned int key)
+{
+    unsigned int i;
+    unsigned int j;
+    unsigned int home;
+
+    if (!index)
+        return 0;
+
+    i = hashidx_find(index, key);
+    if (!index->used[i])
+        return 0;
+
+    /* Backward shift: pull later entries of the run into the hole unless
+     * their home slot lies after it, so no lookup meets an early gap
+     */
+    j = i;
+    while (1)
+    {
+        j = (j + 1) & index->mask;
+        if (!index->used[j])
+            break;
+
+        home = hashidx_home(index, index->keys[j]);
+        if (((j - home) & index->mask) >= ((j - i) & index->mask))
+        {
+            index->keys[i] = index->keys[j];
+            index->values[i] = index->values[j];
+            i = j;
+        }
+    }
+
+    index->used[i] = 0;
+    index->size--;
+    return 1;
+}
+
+unsigned int hashidx_size(HashIdx *index)
+{
+    if (!index)
+        return 0;
+
+    return index->size;
+}
+
+unsigned int hashidx_memory_usage(HashIdx *index)
+{
+    if (!index)
+        return 0;
+
+    return (unsigned int)((index->mask + 1) * HASHIDX_SLOT_BYTES);
+}
+
+unsigned int hashidx_max_probe(HashIdx *index)
+{
+    unsigned int i;
+    unsigned int probe;
+    unsigned int longest;
+
+    if (!index)
+        return 0;
+
+    longest = 0;
+    for (i = 0; i <= index->mask; i++)
+    {
+        if (!index->used[i])
+            continue;
+        probe = ((i - hashidx_home(index, index->keys[i])) & index->mask) + 1;
+        if (probe > longest)
+            longest = probe;
+    }
+
+    return longest;
+}
+
+void hashidx_free(HashIdx *index)
+{
+    if (!index)
+        return;
+
+    free(index->keys);
+    free(index);
+}
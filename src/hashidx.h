@@ -0,0 +1,63 @@
+/* Open-addressing hash index for RP6502
+ * Point lookups on 16-bit keys with the same calls as btree.h, for
+ * callers that never need keys in order. Linear probing in a
+ * power-of-two table that doubles at 3/4 load; a delete shifts the
+ * entries after it back instead of leaving a tombstone, so probe runs
+ * stay as short as the load allows.
+ */
+#ifndef HASHIDX_H
+#define HASHIDX_H
+
+/* Table size bounds in slots, powers of two. A slot takes a key, a value
+ * and a used flag, 5 bytes on the RP6502, so the largest table is 40K.
+ */
+#ifndef HASHIDX_MIN_SLOTS
+#define HASHIDX_MIN_SLOTS 16
+#endif
+
+#ifndef HASHIDX_MAX_SLOTS
+#define HASHIDX_MAX_SLOTS 8192
+#endif
+
+typedef struct
+{
+    unsigned int *keys;        /* Slot keys; the block holding all three arrays */
+    void **values;             /* Slot values */
+    unsigned char *used;       /* 1 for an occupied slot */
+    unsigned int mask;         /* Slots - 1 */
+    unsigned char shift;       /* 16 - log2(slots), takes the hash's top bits */
+    unsigned int size;         /* Keys in the index */
+    unsigned int failures;     /* Inserts dropped because the table could not grow */
+} HashIdx;
+
+/* Initialize a new, empty index of HASHIDX_MIN_SLOTS slots */
+HashIdx *hashidx_create(void);
+
+/* Insert a key-value pair, replacing the value of a present key. The table
+ * doubles first when the key would take it past 3/4 full; if it cannot,
+ * the insert is dropped and counted in failures.
+ */
+void hashidx_insert(HashIdx *index, unsigned int key, void *value);
+
+/* Search for a key, returns its value or NULL if not found */
+void *hashidx_get(HashIdx *index, unsigned int key);
+
+/* Update an existing key's value */
+unsigned char hashidx_update(HashIdx *index, unsigned int key, void *new_value);
+
+/* Delete a key, returns 1 if it was present */
+unsigned char hashidx_delete(HashIdx *index, unsigned int key);
+
+/* Keys in the index */
+unsigned int hashidx_size(HashIdx *index);
+
+/* Bytes taken by the table */
+unsigned int hashidx_memory_usage(HashIdx *index);
+
+/* Slots the longest lookup of a present key inspects */
+unsigned int hashidx_max_probe(HashIdx *index);
+
+/* Free the table and the index */
+void hashidx_free(HashIdx *index);
+
+#endif
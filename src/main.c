@@ -9,12 +9,8 @@ static char *names[] = {"Alice", "Bob", "Charlie", "Diana", "Eve", "Frank"};
 static char *statuses[] = {"ok", "error", "pending", "done", "did not complete"};
 static char *roles[] = {"admin", "user", "guest", "moderator"};
 static char *events[] = {"loginx", "logout", "update", "delete", "create"};
-static char json1[64];
-static char json2[64];
-static char json3[64];
-static char json4[64];
-static char json5[64];
-static char json6[64];
+/* JSON values are formatted here and copied into the tree's value arena */
+static char json_buf[64];
 
 /* Track valid numeric and string keys separately */
 #define KEY_LIST_MAX 1200
@@ -23,6 +19,15 @@ static unsigned int numeric_key_count = 0;
 static unsigned int string_keys[10];
 static unsigned int string_key_count = 0;
 
+/* Node pool for the stress tree: room for the most keys a run inserts
+ * with every node at its minimum fill, so no insert is refused and
+ * btree_clear() can rewind the pool between runs.
+ */
+#define STRESS_MAX_KEYS (1000 + 6)
+#define STRESS_LEAVES (STRESS_MAX_KEYS / BTREE_MIN_KEYS + 1)
+#define STRESS_POOL_BYTES (STRESS_LEAVES * BTREE_LEAF_SIZE + \
+                           (STRESS_LEAVES / BTREE_MIN_KEYS + BTREE_MAX_HEIGHT) * BTREE_NODE_SIZE)
+
 /* Track which runs failed for reporting */
 #define MAX_FAILED_RUNS 10
 #define MAX_FAILED_OPS 50
@@ -43,7 +48,11 @@ static unsigned int failed_ops_count = 0;
 void main()
 {
     BTree *tree;
+    BTreeArena *arena;
+    BTreeArenaStats arena_stats;
+    BTreeFingerStats finger_stats;
     void *value;
+    BTreeValue *slot;
     unsigned int node_count;
     unsigned int unique_key_count;
     unsigned int i;
@@ -54,7 +63,6 @@ void main()
     unsigned int json_key;
     unsigned int json_count;
     unsigned char json_index;
-    char *json_ptrs[6];
     int rand_val;
     unsigned int json_keys[6];
     unsigned int update_count;
@@ -74,6 +82,7 @@ void main()
     unsigned int numeric_updates_failed;
     unsigned int string_updates_attempted;
     unsigned int string_updates_failed;
+    unsigned int json_inserts_failed;
     unsigned int stress_runs;
     unsigned int run_index;
     unsigned int runs_ok;
@@ -84,6 +93,16 @@ void main()
     stress_runs = 100;
     runs_ok = 0;
 
+    /* One pool-backed tree serves every run; btree_clear() empties it in
+     * between by rewinding the pool
+     */
+    tree = btree_create_pool(STRESS_POOL_BYTES);
+    if (!tree)
+    {
+        puts("Failed to create tree");
+        return;
+    }
+
     for (run_index = 0; run_index < stress_runs; run_index++)
     {
         /* Reset per-run counters */
@@ -98,19 +117,23 @@ void main()
         numeric_updates_failed = 0;
         string_updates_attempted = 0;
         string_updates_failed = 0;
+        json_inserts_failed = 0;
 
         /* Seed random number generator with hardware random */
         srand((unsigned int)lrand());
 
-        /* Create tree */
-        tree = btree_create();
+        arena = btree_arena_create();
 
-        if (!tree)
+        if (!arena)
         {
-            puts("Failed to create tree");
+            puts("Failed to create arena");
             return;
         }
 
+        /* Keys arrive as ascending sequence ids */
+        btree_set_split_policy(tree, BTREE_SPLIT_APPEND);
+        btree_set_finger(tree, 1);
+
         printf("\n-- Run %u --\n", run_index + 1);
 
         puts("Inserting sequential unique entries...");
@@ -141,40 +164,51 @@ void main()
     /* INSERT JSON strings with randomized keys and content */
     puts("Generating and inserting JSON strings with randomized content...");
     
-    /* Generate randomized JSON content */
-    rand_val = rand() % 100;
-    sprintf(json1, "{\"name\":\"%s\",\"age\":%d}", names[rand() % 6], 20 + (rand() % 50));
-    
-    rand_val = rand() % 1000;
-    sprintf(json2, "{\"status\":\"%s\",\"code\":%d}", statuses[rand() % 5], 100 + (rand() % 400));
-    
-    rand_val = rand() % 10000;
-    sprintf(json3, "{\"user\":\"%s\",\"role\":\"%s\"}", names[rand() % 6], roles[rand() % 4]);
-    
-    rand_val = rand() % 100;
-    sprintf(json4, "{\"id\":%d,\"count\":%d}", rand() % 1000, rand() % 100);
-    
-    rand_val = (rand() << 10) | rand();
-    sprintf(json5, "{\"timestamp\":%d,\"event\":\"%s\"}", rand_val, events[rand() % 5]);
-    
-    rand_val = rand() % 256;
-    sprintf(json6, "{\"value\":%d,\"active\":%s}", rand() % 1000, (rand() % 2) ? "true" : "false");
-    
-    json_ptrs[0] = json1;
-    json_ptrs[1] = json2;
-    json_ptrs[2] = json3;
-    json_ptrs[3] = json4;
-    json_ptrs[4] = json5;
-    json_ptrs[5] = json6;
-    
     json_count = 5;  /* configurable: 1-6 */
     
     for (json_index = 0; json_index < json_count; json_index++)
     {
+        /* Generate randomized JSON content */
+        switch (json_index)
+        {
+        case 0:
+            sprintf(json_buf, "{\"name\":\"%s\",\"age\":%d}", names[rand() % 6], 20 + (rand() % 50));
+            break;
+        case 1:
+            sprintf(json_buf, "{\"status\":\"%s\",\"code\":%d}", statuses[rand() % 5], 100 + (rand() % 400));
+            break;
+        case 2:
+            sprintf(json_buf, "{\"user\":\"%s\",\"role\":\"%s\"}", names[rand() % 6], roles[rand() % 4]);
+            break;
+        case 3:
+            sprintf(json_buf, "{\"id\":%d,\"count\":%d}", rand() % 1000, rand() % 100);
+            break;
+        case 4:
+            rand_val = (rand() << 10) | rand();
+            sprintf(json_buf, "{\"timestamp\":%d,\"event\":\"%s\"}", rand_val, events[rand() % 5]);
+            break;
+        default:
+            sprintf(json_buf, "{\"value\":%d,\"active\":%s}", rand() % 1000, (rand() % 2) ? "true" : "false");
+            break;
+        }
+
         json_key = (unsigned int)((rand() & 0x7FFF) + 30000);
         json_keys[json_index] = json_key;
-        btree_insert(tree, json_key, (void *)json_ptrs[json_index]);
-        printf("  Inserted JSON %u at key %u: %s\n", json_index + 1, json_key, json_ptrs[json_index]);
+        if (!btree_put(tree, arena, json_key, json_buf, (unsigned char)(strlen(json_buf) + 1)))
+        {
+            json_inserts_failed++;
+            printf("  JSON %u insert failed at key %u\n", json_index + 1, json_key);
+            if (failed_ops_count < MAX_FAILED_OPS)
+            {
+                failed_ops[failed_ops_count].run_num = run_index + 1;
+                failed_ops[failed_ops_count].key = json_key;
+                strcpy(failed_ops[failed_ops_count].op_type, "json_insert");
+                strcpy(failed_ops[failed_ops_count].reason, "out of memory");
+                failed_ops_count++;
+            }
+            continue;
+        }
+        printf("  Inserted JSON %u at key %u: %s\n", json_index + 1, json_key, json_buf);
         
         /* Track string key separately */
         if (string_key_count < 10)
@@ -184,7 +218,7 @@ void main()
         }
     }
 
-    printf("Inserted %u JSON strings.\n\n", json_count);
+    printf("Inserted %u JSON strings.\n\n", json_count - json_inserts_failed);
 
     /* RANDOM GET operations */
     puts("Performing random gets...");
@@ -279,9 +313,12 @@ void main()
                 update_value = 1;
             
             numeric_updates_attempted++;
-            if (btree_update(tree, update_key, (void *)(unsigned int)update_value))
+            /* One descent finds the slot; the new value is stored in place */
+            slot = btree_get_slot(tree, update_key, 0);
+            if (slot)
             {
-                value = btree_get(tree, update_key);
+                *slot = (void *)(unsigned int)update_value;
+                value = *slot;
                 if (value != NULL && (int)(unsigned int)value == update_value)
                 {
                     updates_successful++;
@@ -324,15 +361,17 @@ void main()
         for (json_index = 0; json_index < string_key_count && json_index < 6; json_index++)
         {
             /* Generate new random JSON content */
-            sprintf(json_ptrs[json_index], "{\"updated\":%d,\"run\":%u}", 
+            sprintf(json_buf, "{\"updated\":%d,\"run\":%u}", 
                     rand() % 10000, run_index + 1);
             
             update_key = string_keys[json_index];
             string_updates_attempted++;
-            if (btree_update(tree, update_key, (void *)json_ptrs[json_index]))
+            /* One descent finds the key; the arena stores through its slot */
+            slot = btree_get_slot(tree, update_key, 0);
+            if (slot && btree_put_slot(arena, slot, json_buf, (unsigned char)(strlen(json_buf) + 1)))
             {
-                value = btree_get(tree, update_key);
-                if (value != NULL && strcmp((char *)value, json_ptrs[json_index]) == 0)
+                value = *slot;
+                if (value != NULL && strcmp((char *)value, json_buf) == 0)
                 {
                     updates_successful++;
                 }
@@ -340,7 +379,7 @@ void main()
                 {
                     string_updates_failed++;
                     printf("String update verify failed for key %u (expected: %s, got: %s)\n", 
-                           update_key, json_ptrs[json_index], (char *)value);
+                           update_key, json_buf, (char *)value);
                     if (failed_ops_count < MAX_FAILED_OPS)
                     {
                         failed_ops[failed_ops_count].run_num = run_index + 1;
@@ -355,13 +394,13 @@ void main()
             else
             {
                 string_updates_failed++;
-                printf("String update failed: key %u not found\n", update_key);
+                printf("String update failed: key %u not found or out of memory\n", update_key);
                 if (failed_ops_count < MAX_FAILED_OPS)
                 {
                     failed_ops[failed_ops_count].run_num = run_index + 1;
                     failed_ops[failed_ops_count].key = update_key;
                     strcpy(failed_ops[failed_ops_count].op_type, "string_update");
-                    strcpy(failed_ops[failed_ops_count].reason, "key not found");
+                    strcpy(failed_ops[failed_ops_count].reason, slot ? "out of memory" : "key not found");
                     failed_ops_count++;
                 }
             }
@@ -450,12 +489,18 @@ void main()
 
     printf("Completed %u random deletes (%u successful).\n\n", deletes_attempted, deletes_successful);
 
-    unique_key_count = (unsigned int)item_count;
-    unique_key_count = (unsigned int)(unique_key_count - deletes_successful);
+    unique_key_count = btree_size(tree);
 
     node_count = btree_node_count(tree);
     printf("Unique key count: %u\n", unique_key_count);
     printf("Node count: %u\n", node_count);
+    printf("Node memory: %u bytes (%u with uniform nodes)\n",
+           btree_memory_usage(tree), (unsigned int)(node_count * BTREE_NODE_SIZE));
+    if (btree_arena_stats(arena, &arena_stats))
+        printf("JSON arena: %u values, %u bytes in %u bytes of chunks\n",
+               arena_stats.values, arena_stats.value_bytes, arena_stats.chunk_bytes);
+    if (btree_finger_stats(tree, &finger_stats))
+        printf("Finger: %u hits, %u misses\n", finger_stats.hits, finger_stats.misses);
 
     putchar('\n');
     puts("Demo complete! xxx");
@@ -473,9 +518,12 @@ void main()
         printf("  String updates failed: %u\n", string_updates_failed);
     }
     printf("Deletes: %u/%u verified\n", deletes_successful, deletes_attempted);
+    if (json_inserts_failed > 0)
+        printf("JSON inserts failed: %u\n", json_inserts_failed);
     
     run_ok = 0;
-    if (gets_successful == get_count && updates_successful == expected_updates && deletes_successful == deletes_attempted)
+    if (gets_successful == get_count && updates_successful == expected_updates && deletes_successful == deletes_attempted &&
+        json_inserts_failed == 0)
     {
         puts("\nResult: OK - All operations verified successfully");
         run_ok = 1;
@@ -490,6 +538,7 @@ void main()
                (updates_successful == expected_updates) ? "YES" : "NO");
         printf("  Deletes: %u == %u? %s\n", deletes_successful, deletes_attempted, 
                (deletes_successful == deletes_attempted) ? "YES" : "NO");
+        printf("  JSON inserts failed: %u\n", json_inserts_failed);
         
         /* Record validation failure details */
         if (gets_successful != get_count && failed_ops_count < MAX_FAILED_OPS)
@@ -536,8 +585,15 @@ void main()
            run_index + 1, run_ok ? "PASSED" : "FAILED", runs_ok, run_index + 1);
 
     /* Cleanup */
-    btree_free(tree);
+    btree_arena_destroy(arena);
+    if (!btree_clear(tree))
+    {
+        puts("Failed to reset tree");
+        return;
     }
+    }
+
+    btree_free(tree);
 
     /* Stress summary */
     printf("\nStress summary: %u/%u runs passed\n", runs_ok, stress_runs);
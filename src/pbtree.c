@@ -0,0 +1,1677 @@
+#include "pbtree.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef __CC65__
+#include <rp6502.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <stdio.h>
+#endif
+
+/* Bytes of a page image actually used by the node fields */
+#define PAGE_IMAGE_SIZE (4 + 6 * PBTREE_MAX_KEYS)
+
+/* Page file header, stored at the start of page 0 */
+#define HEADER_SIZE 16
+#define HEADER_MAGIC0 'B'
+#define HEADER_MAGIC1 'T'
+#define HEADER_MAGIC2 'P'
+#define HEADER_VERSION 1
+
+/* Journal record: op, key, value */
+#define JOURNAL_PUT 1
+#define JOURNAL_DELETE 2
+
+static void checkpoint(PBTree *tree);
+
+/* Little-endian 16-bit fields of page images and the file header */
+static unsigned int image_get(const unsigned char *image, unsigned int *pos)
+{
+    unsigned int v;
+
+    v = (unsigned int)(image[*pos] | (image[*pos + 1] << 8));
+    *pos += 2;
+    return v;
+}
+
+static void image_put(unsigned char *image, unsigned int *pos, unsigned int v)
+{
+    image[*pos] = (unsigned char)(v & 0xFF);
+    image[*pos + 1] = (unsigned char)((v >> 8) & 0xFF);
+    *pos += 2;
+}
+
+
+#ifdef __CC65__
+/* cc65 lays PBTreePage out exactly like the page image (16-bit little-endian
+ * fields, no padding), so pages move between XRAM and a frame unconverted.
+ */
+typedef char pbtree_image_check[(sizeof(PBTreePage) == PAGE_IMAGE_SIZE) ? 1 : -1];
+
+static void xram_read(unsigned int addr, unsigned char *buf, unsigned int n)
+{
+    RIA.step0 = 1;
+    RIA.addr0 = addr;
+    while (n--)
+        *buf++ = RIA.rw0;
+}
+
+static void xram_write(unsigned int addr, const unsigned char *buf, unsigned int n)
+{
+    RIA.step0 = 1;
+    RIA.addr0 = addr;
+    while (n--)
+        RIA.rw0 = *buf++;
+}
+#else
+/* Host builds emulate the 64 KB of XRAM with a plain array */
+static unsigned char xram[0x10000UL];
+
+static void xram_read(unsigned int addr, unsigned char *buf, unsigned int n)
+{
+    memcpy(buf, xram + addr, n);
+}
+
+static void xram_write(unsigned int addr, const unsigned char *buf, unsigned int n)
+{
+    memcpy(xram + addr, buf, n);
+}
+
+static void page_decode(PBTreePage *page, const unsigned char *image)
+{
+    unsigned int pos;
+    unsigned char i;
+
+    page->key_count = image[0];
+    page->is_leaf = image[1];
+    pos = 2;
+    for (i = 0; i < PBTREE_MAX_KEYS; i++)
+        page->keys[i] = image_get(image, &pos);
+    for (i = 0; i < PBTREE_MAX_KEYS; i++)
+        page->values[i] = image_get(image, &pos);
+    for (i = 0; i < PBTREE_MAX_CHILDREN; i++)
+        page->children[i] = image_get(image, &pos);
+}
+
+static void page_encode(const PBTreePage *page, unsigned char *image)
+{
+    unsigned int pos;
+    unsigned char i;
+
+    image[0] = page->key_count;
+    image[1] = page->is_leaf;
+    pos = 2;
+    for (i = 0; i < PBTREE_MAX_KEYS; i++)
+        image_put(image, &pos, page->keys[i]);
+    for (i = 0; i < PBTREE_MAX_KEYS; i++)
+        image_put(image, &pos, page->values[i]);
+    for (i = 0; i < PBTREE_MAX_CHILDREN; i++)
+        image_put(image, &pos, page->children[i]);
+}
+#endif
+
+/* Page files. cc65 goes through the RP6502 POSIX-style file calls; host
+ * builds use stdio, with a small table standing in for descriptors.
+ */
+#ifdef __CC65__
+static int file_open(const char *path, unsigned char create)
+{
+    if (create)
+        return open(path, O_RDWR | O_CREAT | O_TRUNC);
+    return open(path, O_RDWR);
+}
+
+static unsigned char file_read(int fd, unsigned long offset, unsigned char *buf, unsigned int n)
+{
+    if (lseek(fd, (off_t)offset, SEEK_SET) < 0)
+        return 0;
+    return (unsigned char)(read(fd, buf, n) == (int)n);
+}
+
+static unsigned char file_write(int fd, unsigned long offset, const unsigned char *buf, unsigned int n)
+{
+    if (lseek(fd, (off_t)offset, SEEK_SET) < 0)
+        return 0;
+    return (unsigned char)(write(fd, buf, n) == (int)n);
+}
+
+/* cc65 has no fsync(); write() has already handed the data to the RIA */
+static void file_sync(int fd)
+{
+    (void)fd;
+}
+
+static void file_close(int fd)
+{
+    close(fd);
+}
+#else
+#define HOST_FILES 4
+
+static FILE *host_files[HOST_FILES];
+
+static int file_open(const char *path, unsigned char create)
+{
+    int fd;
+
+    for (fd = 0; fd < HOST_FILES; fd++)
+        if (!host_files[fd])
+            break;
+    if (fd == HOST_FILES)
+        return -1;
+
+    host_files[fd] = fopen(path, create ? "w+b" : "r+b");
+    return host_files[fd] ? fd : -1;
+}
+
+static unsigned char file_read(int fd, unsigned long offset, unsigned char *buf, unsigned int n)
+{
+    if (fseek(host_files[fd], (long)offset, SEEK_SET) != 0)
+        return 0;
+    return (unsigned char)(fread(buf, 1, n, host_files[fd]) == n);
+}
+
+static unsigned char file_write(int fd, unsigned long offset, const unsigned char *buf, unsigned int n)
+{
+    if (fseek(host_files[fd], (long)offset, SEEK_SET) != 0)
+        return 0;
+    return (unsigned char)(fwrite(buf, 1, n, host_files[fd]) == n);
+}
+
+static void file_sync(int fd)
+{
+    fflush(host_files[fd]);
+}
+
+static void file_close(int fd)
+{
+    fclose(host_files[fd]);
+    host_files[fd] = NULL;
+}
+#endif
+
+/* Raw access to the first n bytes of page id in XRAM or the page file.
+ * A failed file read leaves zeros and is counted in io_errors.
+ */
+static void store_read(PBTree *tree, unsigned int id, unsigned char *buf, unsigned int n)
+{
+    if (tree->fd < 0)
+    {
+        xram_read((unsigned int)(tree->xram_base + (id - 1) * PBTREE_PAGE_SIZE), buf, n);
+        return;
+    }
+
+    if (!file_read(tree->fd, (unsigned long)id * PBTREE_PAGE_SIZE, buf, n))
+    {
+        memset(buf, 0, n);
+        tree->io_errors++;
+    }
+}
+
+static void store_write(PBTree *tree, unsigned int id, const unsigned char *buf, unsigned int n)
+{
+    if (tree->fd < 0)
+        xram_write((unsigned int)(tree->xram_base + (id - 1) * PBTREE_PAGE_SIZE), buf, n);
+    else if (!file_write(tree->fd, (unsigned long)id * PBTREE_PAGE_SIZE, buf, n))
+        tree->io_errors++;
+}
+
+static void page_read(PBTree *tree, unsigned int id, PBTreePage *page)
+{
+#ifdef __CC65__
+    store_read(tree, id, (unsigned char *)page, PAGE_IMAGE_SIZE);
+#else
+    unsigned char image[PAGE_IMAGE_SIZE];
+
+    store_read(tree, id, image, PAGE_IMAGE_SIZE);
+    page_decode(page, image);
+#endif
+}
+
+static void page_write(PBTree *tree, unsigned int id, PBTreePage *page)
+{
+#ifdef __CC65__
+    store_write(tree, id, (unsigned char *)page, PAGE_IMAGE_SIZE);
+#else
+    unsigned char image[PAGE_IMAGE_SIZE];
+
+    page_encode(page, image);
+    store_write(tree, id, image, PAGE_IMAGE_SIZE);
+#endif
+    tree->writes++;
+}
+
+/* Spill slot holding page id, or spill_count */
+static unsigned char spill_find(PBTree *tree, unsigned int id)
+{
+    unsigned char i;
+
+    for (i = 0; i < tree->spill_count; i++)
+        if (tree->spill[i] == id)
+            break;
+    return i;
+}
+
+static unsigned int spill_addr(unsigned char slot)
+{
+    return (unsigned int)(PBTREE_SPILL_BASE + (unsigned int)slot * PBTREE_PAGE_SIZE);
+}
+
+static void spill_read(unsigned char slot, PBTreePage *page)
+{
+#ifdef __CC65__
+    xram_read(spill_addr(slot), (unsigned char *)page, PAGE_IMAGE_SIZE);
+#else
+    unsigned char image[PAGE_IMAGE_SIZE];
+
+    xram_read(spill_addr(slot), image, PAGE_IMAGE_SIZE);
+    page_decode(page, image);
+#endif
+}
+
+/* There is one spill area; the journaled tree using it */
+static PBTree *spill_owner;
+
+/* Park a dirty frame of a journaled tree in its spill slot, returns 0 if
+ * the spill area is full. Another tree's spilled pages are checkpointed
+ * out first.
+ */
+static unsigned char spill_write(PBTree *tree, PBTreeFrame *frame)
+{
+#ifndef __CC65__
+    unsigned char image[PAGE_IMAGE_SIZE];
+#endif
+    unsigned char slot;
+
+    if (spill_owner != tree)
+    {
+        if (spill_owner)
+            checkpoint(spill_owner);
+        spill_owner = tree;
+    }
+
+    slot = spill_find(tree, frame->id);
+    if (slot >= tree->spill_count)
+    {
+        if (tree->spill_count == PBTREE_SPILL_PAGES)
+            return 0;
+        slot = tree->spill_count++;
+        tree->spill[slot] = frame->id;
+    }
+
+#ifdef __CC65__
+    xram_write(spill_addr(slot), (unsigned char *)&frame->page, PAGE_IMAGE_SIZE);
+#else
+    page_encode(&frame->page, image);
+    xram_write(spill_addr(slot), image, PAGE_IMAGE_SIZE);
+#endif
+    frame->dirty = 0;
+    tree->spills++;
+    return 1;
+}
+
+/* Read page id, preferring a newer copy in the spill area */
+static void page_load(PBTree *tree, unsigned int id, PBTreePage *page)
+{
+    unsigned char slot;
+
+    slot = spill_find(tree, id);
+    if (slot < tree->spill_count)
+        spill_read(slot, page);
+    else
+        page_read(tree, id, page);
+}
+
+/* Pick a frame for a new page: an empty one, else the least recently
+ * used unpinned one, written back first if dirty.
+ */
+static PBTreeFrame *frame_claim(PBTree *tree)
+{
+    PBTreeFrame *frame;
+    PBTreeFrame *victim;
+    unsigned char i;
+
+    victim = NULL;
+    for (i = 0; i < PBTREE_CACHE_PAGES; i++)
+    {
+        frame = &tree->frames[i];
+        if (frame->pins)
+            continue;
+        if (frame->id == PBTREE_NO_PAGE)
+            return frame;
+        if (!victim || frame->stamp < victim->stamp)
+            victim = frame;
+    }
+
+    if (victim && victim->dirty)
+    {
+        /* A journaled tree only writes pages at a checkpoint, which never
+         * runs in the middle of an operation: the file keeps the last
+         * one. journal_reserve() leaves the spill area room for a whole
+         * operation, so a full one means no frame.
+         */
+        if (tree->journal_fd >= 0)
+        {
+            if (!spill_write(tree, victim))
+                return NULL;
+        }
+        else
+        {
+            page_write(tree, victim->id, &victim->page);
+            victim->dirty = 0;
+        }
+    }
+    return victim;
+}
+
+static void frame_touch(PBTree *tree, PBTreeFrame *frame)
+{
+    unsigned char i;
+
+    tree->clock++;
+    if (tree->clock == 0)
+    {
+        /* Clock wrapped: restart every frame at the same age */
+        for (i = 0; i < PBTREE_CACHE_PAGES; i++)
+            tree->frames[i].stamp = 0;
+        tree->clock = 1;
+    }
+
+    frame->stamp = tree->clock;
+    frame->pins++;
+}
+
+static PBTreeFrame *frame_find(PBTree *tree, unsigned int id)
+{
+    unsigned char i;
+
+    for (i = 0; i < PBTREE_CACHE_PAGES; i++)
+        if (tree->frames[i].id == id)
+            return &tree->frames[i];
+    return NULL;
+}
+
+/* Pin page id in a frame, reading it in on a miss. Never fails while
+ * fewer than PBTREE_CACHE_PAGES frames are pinned and, on a journaled
+ * tree, journal_reserve() has run.
+ */
+static PBTreeFrame *page_get(PBTree *tree, unsigned int id)
+{
+    PBTreeFrame *frame;
+
+    frame = frame_find(tree, id);
+    if (frame)
+    {
+        tree->hits++;
+        frame_touch(tree, frame);
+        return frame;
+    }
+
+    frame = frame_claim(tree);
+    if (!frame)
+        return NULL;
+
+    tree->misses++;
+    page_load(tree, id, &frame->page);
+    frame->id = id;
+    frame->dirty = 0;
+    frame_touch(tree, frame);
+    return frame;
+}
+
+static void page_put(PBTreeFrame *frame)
+{
+    frame->pins--;
+}
+
+/* Allocate an empty page, pinned. Returns NULL when the store is full. */
+static PBTreeFrame *page_new(PBTree *tree, unsigned char is_leaf)
+{
+    PBTreeFrame *frame;
+    unsigned char link[2];
+    unsigned int id;
+    unsigned char i;
+
+    if (tree->free_list != PBTREE_NO_PAGE)
+    {
+        id = tree->free_list;
+        frame = frame_find(tree, id);
+        if (frame)
+        {
+            /* Released recently and still cached with its link */
+            link[0] = frame->page.key_count;
+            link[1] = frame->page.is_leaf;
+        }
+        else
+        {
+            frame = frame_claim(tree);
+            if (!frame)
+                return NULL;
+            i = spill_find(tree, id);
+            if (i < tree->spill_count)
+                xram_read(spill_addr(i), link, 2);
+            else
+                store_read(tree, id, link, 2);
+        }
+        tree->free_list = (unsigned int)(link[0] | (link[1] << 8));
+    }
+    else if (tree->carved < tree->pages)
+    {
+        frame = frame_claim(tree);
+        if (!frame)
+            return NULL;
+        tree->carved++;
+        id = tree->carved;
+    }
+    else
+        return NULL;
+
+    tree->used++;
+    frame->id = id;
+    frame->dirty = 1;
+    frame->page.key_count = 0;
+    frame->page.is_leaf = is_leaf;
+    if (!is_leaf)
+        for (i = 0; i < PBTREE_MAX_CHILDREN; i++)
+            frame->page.children[i] = PBTREE_NO_PAGE;
+    frame_touch(tree, frame);
+    return frame;
+}
+
+/* Unpin a page and put it on the free list. The link occupies the first
+ * two image bytes (key_count and is_leaf), so the page stays cached and
+ * dirty: the link reaches the store with the next write-back, never ahead
+ * of the parent page that stopped pointing at it.
+ */
+static void page_release(PBTree *tree, PBTreeFrame *frame)
+{
+    frame->page.key_count = (unsigned char)(tree->free_list & 0xFF);
+    frame->page.is_leaf = (unsigned char)((tree->free_list >> 8) & 0xFF);
+
+    tree->free_list = frame->id;
+    tree->used--;
+    frame->dirty = 1;
+    frame->pins = 0;
+    frame->stamp = 0; /* First to be evicted */
+}
+
+/* Index of the first key >= key, or key_count if there is none */
+static unsigned char page_find(PBTreePage *page, unsigned int key)
+{
+    unsigned char lo;
+    unsigned char hi;
+    unsigned char mid;
+
+    lo = 0;
+    hi = page->key_count;
+    while (lo < hi)
+    {
+        mid = (unsigned char)((lo + hi) >> 1);
+        if (page->keys[mid] < key)
+            lo = (unsigned char)(mid + 1);
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static PBTree *tree_alloc(void)
+{
+    PBTree *tree;
+    unsigned char i;
+
+    tree = (PBTree *)malloc(sizeof(PBTree));
+    if (!tree)
+        return NULL;
+
+    tree->root = PBTREE_NO_PAGE;
+    tree->xram_base = 0;
+    tree->fd = -1;
+    tree->pages = 0;
+    tree->carved = 0;
+    tree->free_list = PBTREE_NO_PAGE;
+    tree->used = 0;
+    tree->clock = 0;
+    tree->hits = 0;
+    tree->misses = 0;
+    tree->writes = 0;
+    tree->io_errors = 0;
+    tree->flushes = 0;
+    tree->checkpoints = 0;
+    tree->spills = 0;
+    tree->height = 0;
+    tree->spill_count = 0;
+    tree->journal_fd = -1;
+    tree->journal_size = 0;
+    tree->journal_group = 0;
+    tree->journal_count = 0;
+    tree->replaying = 0;
+    tree->journal_path[0] = '\0';
+    for (i = 0; i < PBTREE_CACHE_PAGES; i++)
+    {
+        tree->frames[i].id = PBTREE_NO_PAGE;
+        tree->frames[i].stamp = 0;
+        tree->frames[i].pins = 0;
+        tree->frames[i].dirty = 0;
+    }
+
+    return tree;
+}
+
+static void tree_new_root(PBTree *tree)
+{
+    PBTreeFrame *root;
+
+    root = page_new(tree, 1);
+    tree->root = root->id;
+    page_put(root);
+}
+
+PBTree *pbtree_create(unsigned int xram_base, unsigned int pages)
+{
+    PBTree *tree;
+
+    /* The window must end below the spill area at the top of XRAM */
+    if (xram_base >= PBTREE_SPILL_BASE)
+        return NULL;
+    if ((unsigned long)xram_base + (unsigned long)pages * PBTREE_PAGE_SIZE > PBTREE_SPILL_BASE)
+        pages = (PBTREE_SPILL_BASE - xram_base) / PBTREE_PAGE_SIZE;
+    if (pages == 0)
+        return NULL;
+
+    tree = tree_alloc();
+    if (!tree)
+        return NULL;
+
+    tree->xram_base = xram_base;
+    tree->pages = pages;
+    tree_new_root(tree);
+
+    return tree;
+}
+
+static void header_write(PBTree *tree)
+{
+    unsigned char header[HEADER_SIZE];
+    unsigned int pos;
+
+    memset(header, 0, HEADER_SIZE);
+    header[0] = HEADER_MAGIC0;
+    header[1] = HEADER_MAGIC1;
+    header[2] = HEADER_MAGIC2;
+    header[3] = HEADER_VERSION;
+    pos = 4;
+    image_put(header, &pos, PBTREE_PAGE_SIZE);
+    image_put(header, &pos, tree->root);
+    image_put(header, &pos, tree->carved);
+    image_put(header, &pos, tree->free_list);
+    image_put(header, &pos, tree->used);
+
+    if (!file_write(tree->fd, 0, header, HEADER_SIZE))
+        tree->io_errors++;
+}
+
+/* Derive "<path>.jnl"; leaves the name empty if path is too long */
+static void journal_name(PBTree *tree, const char *path)
+{
+    if (strlen(path) + 5 > PBTREE_PATH_MAX)
+        return;
+
+    strcpy(tree->journal_path, path);
+    strcat(tree->journal_path, ".jnl");
+}
+
+/* Append the pending group to the journal file */
+static void journal_write(PBTree *tree)
+{
+    unsigned int bytes;
+
+    if (tree->journal_count == 0)
+        return;
+
+    bytes = (unsigned int)tree->journal_count * PBTREE_RECORD_SIZE;
+    if (file_write(tree->journal_fd, tree->journal_size, tree->journal_buf, bytes))
+        tree->journal_size += bytes;
+    else
+        tree->io_errors++;
+
+    file_sync(tree->journal_fd);
+    tree->journal_count = 0;
+    tree->flushes++;
+}
+
+static void journal_log(PBTree *tree, unsigned char op, unsigned int key, unsigned int value)
+{
+    unsigned int pos;
+
+    if (tree->journal_fd < 0 || tree->replaying)
+        return;
+
+    pos = (unsigned int)tree->journal_count * PBTREE_RECORD_SIZE;
+    tree->journal_buf[pos] = op;
+    pos++;
+    image_put(tree->journal_buf, &pos, key);
+    image_put(tree->journal_buf, &pos, value);
+
+    tree->journal_count++;
+    if (tree->journal_count >= tree->journal_group)
+        journal_write(tree);
+}
+
+/* Scratch frame for copying spilled pages to the file, kept off the stack */
+static PBTreePage spill_page;
+
+/* Write every spilled and dirty page and the header of a page file.
+ * Cached dirty pages are newer than their spilled copies and go last.
+ */
+static void cache_write(PBTree *tree)
+{
+    PBTreeFrame *frame;
+    unsigned char i;
+
+    for (i = 0; i < tree->spill_count; i++)
+    {
+        spill_read(i, &spill_page);
+        page_write(tree, tree->spill[i], &spill_page);
+    }
+    tree->spill_count = 0;
+
+    for (i = 0; i < PBTREE_CACHE_PAGES; i++)
+    {
+        frame = &tree->frames[i];
+        if (frame->id != PBTREE_NO_PAGE && frame->dirty)
+        {
+            page_write(tree, frame->id, &frame->page);
+            frame->dirty = 0;
+        }
+    }
+    header_write(tree);
+    file_sync(tree->fd);
+}
+
+/* Write every dirty page and the header, then empty the journal. While
+ * the journal is being replayed it is still the source and stays intact.
+ */
+static void checkpoint(PBTree *tree)
+{
+    if (tree->journal_fd >= 0 && !tree->replaying)
+        journal_write(tree);
+
+    cache_write(tree);
+
+    if (tree->journal_fd < 0 || tree->replaying)
+        return;
+
+    tree->checkpoints++;
+    file_close(tree->journal_fd);
+    tree->journal_fd = file_open(tree->journal_path, 1);
+    tree->journal_size = 0;
+    if (tree->journal_fd < 0)
+        tree->io_errors++;
+}
+
+/* Checkpoint between operations unless the spill area has room for the
+ * dirty pages already cached and every page the next one can dirty, so
+ * no page is written in the middle of an operation. The height is 0
+ * until the first operation on an opened file; assume the tallest tree.
+ */
+static void journal_reserve(PBTree *tree)
+{
+    unsigned char dirty;
+    unsigned char levels;
+    unsigned char i;
+
+    if (tree->journal_fd < 0)
+        return;
+
+    dirty = 0;
+    for (i = 0; i < PBTREE_CACHE_PAGES; i++)
+        if (tree->frames[i].id != PBTREE_NO_PAGE && tree->frames[i].dirty)
+            dirty++;
+
+    levels = tree->height ? tree->height : PBTREE_MAX_HEIGHT;
+    if (tree->spill_count + dirty > PBTREE_SPILL_PAGES - 3 * (levels + 1))
+        checkpoint(tree);
+}
+
+/* Apply the records of a journal left by a crash, then fold them in.
+ * Replay stops at the first short or unknown record.
+ */
+static void journal_replay(PBTree *tree)
+{
+    unsigned char record[PBTREE_RECORD_SIZE];
+    unsigned long offset;
+    unsigned int pos;
+    unsigned int key;
+    unsigned int value;
+
+    tree->journal_fd = file_open(tree->journal_path, 0);
+    if (tree->journal_fd < 0)
+        return;
+
+    tree->replaying = 1;
+    offset = 0;
+    while (file_read(tree->journal_fd, offset, record, PBTREE_RECORD_SIZE))
+    {
+        pos = 1;
+        key = image_get(record, &pos);
+        value = image_get(record, &pos);
+
+        if (record[0] == JOURNAL_PUT)
+            pbtree_insert(tree, key, value);
+        else if (record[0] == JOURNAL_DELETE)
+            pbtree_delete(tree, key);
+        else
+            break;
+
+        offset += PBTREE_RECORD_SIZE;
+    }
+    tree->replaying = 0;
+
+    /* Fold the replayed records into the page file and empty the journal */
+    checkpoint(tree);
+    file_close(tree->journal_fd);
+    tree->journal_fd = -1;
+}
+
+PBTree *pbtree_create_file(const char *path)
+{
+    PBTree *tree;
+    int fd;
+
+    fd = file_open(path, 1);
+    if (fd < 0)
+        return NULL;
+
+    tree = tree_alloc();
+    if (!tree)
+    {
+        file_close(fd);
+        return NULL;
+    }
+
+    tree->fd = fd;
+    tree->pages = 0xFFFF;
+    tree_new_root(tree);
+    header_write(tree);
+
+    /* A journal left from an older file of the same name must not replay */
+    journal_name(tree, path);
+    if (tree->journal_path[0])
+    {
+        fd = file_open(tree->journal_path, 1);
+        if (fd >= 0)
+            file_close(fd);
+    }
+
+    return tree;
+}
+
+PBTree *pbtree_open(const char *path)
+{
+    PBTree *tree;
+    unsigned char header[HEADER_SIZE];
+    unsigned int pos;
+    int fd;
+
+    fd = file_open(path, 0);
+    if (fd < 0)
+        return NULL;
+
+    pos = 4;
+    if (!file_read(fd, 0, header, HEADER_SIZE) ||
+        header[0] != HEADER_MAGIC0 || header[1] != HEADER_MAGIC1 ||
+        header[2] != HEADER_MAGIC2 || header[3] != HEADER_VERSION ||
+        image_get(header, &pos) != PBTREE_PAGE_SIZE)
+    {
+        file_close(fd);
+        return NULL;
+    }
+
+    tree = tree_alloc();
+    if (!tree)
+    {
+        file_close(fd);
+        return NULL;
+    }
+
+    /* Only the header is read here; node pages come in on demand */
+    tree->fd = fd;
+    tree->pages = 0xFFFF;
+    tree->root = image_get(header, &pos);
+    tree->carved = image_get(header, &pos);
+    tree->free_list = image_get(header, &pos);
+    tree->used = image_get(header, &pos);
+
+    journal_name(tree, path);
+    if (tree->journal_path[0])
+        journal_replay(tree);
+
+    return tree;
+}
+
+unsigned char pbtree_journal(PBTree *tree, unsigned char group)
+{
+    if (!tree || tree->fd < 0 || !tree->journal_path[0])
+        return 0;
+
+    /* Start from a page file that holds everything so far */
+    pbtree_sync(tree);
+    if (tree->journal_fd >= 0)
+    {
+        file_close(tree->journal_fd);
+        tree->journal_fd = -1;
+    }
+
+    if (group == 0)
+        return 1;
+
+    if (group > PBTREE_JOURNAL_BATCH)
+        group = PBTREE_JOURNAL_BATCH;
+    tree->journal_group = group;
+    tree->journal_count = 0;
+    tree->journal_size = 0;
+    tree->journal_fd = file_open(tree->journal_path, 1);
+
+    return (unsigned char)(tree->journal_fd >= 0);
+}
+
+unsigned char pbtree_flush(PBTree *tree)
+{
+    if (!tree || tree->journal_fd < 0)
+        return 0;
+
+    journal_write(tree);
+    return (unsigned char)(tree->io_errors == 0);
+}
+
+unsigned char pbtree_sync(PBTree *tree)
+{
+    if (!tree)
+        return 0;
+    if (tree->fd < 0)
+        return 1;
+
+    if (tree->journal_fd >= 0)
+        checkpoint(tree);
+    else
+        cache_write(tree);
+
+    return (unsigned char)(tree->io_errors == 0);
+}
+
+/* Split the full child at index around its middle key, which moves up.
+ * Returns the new right sibling pinned, or NULL when the store is full.
+ */
+static PBTreeFrame *split_child(PBTree *tree, PBTreeFrame *parent, unsigned char index, PBTreeFrame *child)
+{
+    PBTreeFrame *sibling;
+    PBTreePage *p;
+    PBTreePage *c;
+    PBTreePage *s;
+    unsigned char i;
+    unsigned char mid;
+
+    sibling = page_new(tree, child->page.is_leaf);
+    if (!sibling)
+        return NULL;
+
+    p = &parent->page;
+    c = &child->page;
+    s = &sibling->page;
+    mid = PBTREE_SPLIT_INDEX;
+
+    for (i = 0; i < PBTREE_MAX_KEYS - mid - 1; i++)
+    {
+        s->keys[i] = c->keys[mid + 1 + i];
+        s->values[i] = c->values[mid + 1 + i];
+    }
+    s->key_count = (unsigned char)(PBTREE_MAX_KEYS - mid - 1);
+
+    if (!c->is_leaf)
+        for (i = 0; i < PBTREE_MAX_CHILDREN - mid - 1; i++)
+            s->children[i] = c->children[mid + 1 + i];
+
+    c->key_count = mid;
+
+    for (i = p->key_count + 1; i > index + 1; i--)
+        p->children[i] = p->children[i - 1];
+    for (i = p->key_count; i > index; i--)
+    {
+        p->keys[i] = p->keys[i - 1];
+        p->values[i] = p->values[i - 1];
+    }
+
+    p->keys[index] = c->keys[mid];
+    p->values[index] = c->values[mid];
+    p->children[index + 1] = sibling->id;
+    p->key_count++;
+
+    parent->dirty = 1;
+    child->dirty = 1;
+    return sibling;
+}
+
+unsigned char pbtree_insert(PBTree *tree, unsigned int key, unsigned int value)
+{
+    PBTreeFrame *node;
+    PBTreeFrame *child;
+    PBTreeFrame *sibling;
+    PBTreePage *n;
+    unsigned char i;
+    unsigned char j;
+    unsigned char depth;
+
+    if (!tree)
+        return 0;
+
+    journal_reserve(tree);
+    depth = 1;
+    node = page_get(tree, tree->root);
+
+    if (node->page.key_count == PBTREE_MAX_KEYS)
+    {
+        /* Root is full, split it */
+        child = node;
+        node = page_new(tree, 0);
+        if (!node)
+        {
+            page_put(child);
+            return 0;
+        }
+
+        node->page.children[0] = child->id;
+        sibling = split_child(tree, node, 0, child);
+        page_put(child);
+        if (!sibling)
+        {
+            page_release(tree, node);
+            return 0;
+        }
+        page_put(sibling);
+        tree->root = node->id;
+        depth++;
+    }
+
+    while (1)
+    {
+        n = &node->page;
+        i = page_find(n, key);
+
+        if (i < n->key_count && key == n->keys[i])
+        {
+            n->values[i] = value;
+            node->dirty = 1;
+            break;
+        }
+
+        if (n->is_leaf)
+        {
+            for (j = n->key_count; j > i; j--)
+            {
+                n->keys[j] = n->keys[j - 1];
+                n->values[j] = n->values[j - 1];
+            }
+            n->keys[i] = key;
+            n->values[i] = value;
+            n->key_count++;
+            node->dirty = 1;
+            break;
+        }
+
+        child = page_get(tree, n->children[i]);
+
+        if (child->page.key_count == PBTREE_MAX_KEYS)
+        {
+            sibling = split_child(tree, node, i, child);
+            if (!sibling)
+            {
+                page_put(child);
+                page_put(node);
+                return 0;
+            }
+
+            /* The promoted key may be the one being inserted */
+            if (key == n->keys[i])
+            {
+                n->values[i] = value;
+                page_put(sibling);
+                page_put(child);
+                break;
+            }
+
+            if (key > n->keys[i])
+            {
+                page_put(child);
+                child = sibling;
+            }
+            else
+                page_put(sibling);
+        }
+
+        page_put(node);
+        node = child;
+        depth++;
+    }
+
+    page_put(node);
+    if (depth > tree->height)
+        tree->height = depth;
+    journal_log(tree, JOURNAL_PUT, key, value);
+    return 1;
+}
+
+/* Pinned page holding key, or the leaf where the search for it ends */
+static PBTreeFrame *page_locate(PBTree *tree, unsigned int key, unsigned char *index)
+{
+    PBTreeFrame *node;
+    PBTreeFrame *child;
+    unsigned char i;
+
+    node = page_get(tree, tree->root);
+
+    while (1)
+    {
+        i = page_find(&node->page, key);
+
+        if ((i < node->page.key_count && key == node->page.keys[i]) || node->page.is_leaf)
+            break;
+
+        child = page_get(tree, node->page.children[i]);
+        page_put(node);
+        node = child;
+    }
+
+    *index = i;
+    return node;
+}
+
+unsigned char pbtree_get(PBTree *tree, unsigned int key, unsigned int *value)
+{
+    PBTreeFrame *node;
+    unsigned char i;
+    unsigned char found;
+
+    if (!tree)
+        return 0;
+
+    node = page_locate(tree, key, &i);
+    found = (unsigned char)(i < node->page.key_count && key == node->page.keys[i]);
+    if (found && value)
+        *value = node->page.values[i];
+    page_put(node);
+
+    return found;
+}
+
+unsigned char pbtree_update(PBTree *tree, unsigned int key, unsigned int value)
+{
+    PBTreeFrame *node;
+    unsigned char i;
+    unsigned char found;
+
+    if (!tree)
+        return 0;
+
+    journal_reserve(tree);
+    node = page_locate(tree, key, &i);
+    found = (unsigned char)(i < node->page.key_count && key == node->page.keys[i]);
+    if (found)
+    {
+        node->page.values[i] = value;
+        node->dirty = 1;
+    }
+    page_put(node);
+
+    if (found)
+        journal_log(tree, JOURNAL_PUT, key, value);
+    return found;
+}
+
+/* Fold the separator at index and the right child into the left child,
+ * then release the right page.
+ */
+static void merge_children(PBTree *tree, PBTreeFrame *parent, unsigned char index, PBTreeFrame *left, PBTreeFrame *right)
+{
+    PBTreePage *p;
+    PBTreePage *l;
+    PBTreePage *r;
+    unsigned char i;
+
+    p = &parent->page;
+    l = &left->page;
+    r = &right->page;
+
+    l->keys[l->key_count] = p->keys[index];
+    l->values[l->key_count] = p->values[index];
+
+    for (i = 0; i < r->key_count; i++)
+    {
+        l->keys[l->key_count + 1 + i] = r->keys[i];
+        l->values[l->key_count + 1 + i] = r->values[i];
+    }
+
+    if (!l->is_leaf)
+        for (i = 0; i <= r->key_count; i++)
+            l->children[l->key_count + 1 + i] = r->children[i];
+
+    l->key_count = (unsigned char)(l->key_count + 1 + r->key_count);
+
+    for (i = index; i < p->key_count - 1; i++)
+    {
+        p->keys[i] = p->keys[i + 1];
+        p->values[i] = p->values[i + 1];
+        p->children[i + 1] = p->children[i + 2];
+    }
+    p->key_count--;
+
+    parent->dirty = 1;
+    left->dirty = 1;
+    page_release(tree, right);
+}
+
+/* Move the separator down into child and the left sibling's last key up */
+static void borrow_left(PBTreeFrame *parent, unsigned char i, PBTreeFrame *left, PBTreeFrame *child)
+{
+    PBTreePage *p;
+    PBTreePage *l;
+    PBTreePage *c;
+    unsigned char j;
+
+    p = &parent->page;
+    l = &left->page;
+    c = &child->page;
+
+    for (j = c->key_count; j > 0; j--)
+    {
+        c->keys[j] = c->keys[j - 1];
+        c->values[j] = c->values[j - 1];
+    }
+    if (!c->is_leaf)
+        for (j = c->key_count + 1; j > 0; j--)
+            c->children[j] = c->children[j - 1];
+
+    c->keys[0] = p->keys[i - 1];
+    c->values[0] = p->values[i - 1];
+    if (!c->is_leaf)
+        c->children[0] = l->children[l->key_count];
+
+    p->keys[i - 1] = l->keys[l->key_count - 1];
+    p->values[i - 1] = l->values[l->key_count - 1];
+
+    l->key_count--;
+    c->key_count++;
+
+    parent->dirty = 1;
+    left->dirty = 1;
+    child->dirty = 1;
+}
+
+/* Move the separator down into child and the right sibling's first key up */
+static void borrow_right(PBTreeFrame *parent, unsigned char i, PBTreeFrame *child, PBTreeFrame *right)
+{
+    PBTreePage *p;
+    PBTreePage *c;
+    PBTreePage *r;
+    unsigned char j;
+
+    p = &parent->page;
+    c = &child->page;
+    r = &right->page;
+
+    c->keys[c->key_count] = p->keys[i];
+    c->values[c->key_count] = p->values[i];
+    if (!c->is_leaf)
+        c->children[c->key_count + 1] = r->children[0];
+
+    p->keys[i] = r->keys[0];
+    p->values[i] = r->values[0];
+
+    for (j = 0; j < r->key_count - 1; j++)
+    {
+        r->keys[j] = r->keys[j + 1];
+        r->values[j] = r->values[j + 1];
+    }
+    if (!r->is_leaf)
+        for (j = 0; j < r->key_count; j++)
+            r->children[j] = r->children[j + 1];
+
+    r->key_count--;
+    c->key_count++;
+
+    parent->dirty = 1;
+    child->dirty = 1;
+    right->dirty = 1;
+}
+
+/* Pinned leaf at the far right (or left) end of the subtree under start */
+static PBTreeFrame *page_edge(PBTree *tree, PBTreeFrame *start, unsigned char rightmost)
+{
+    PBTreeFrame *node;
+    PBTreeFrame *child;
+
+    node = start;
+    node->pins++;
+    while (!node->page.is_leaf)
+    {
+        child = page_get(tree, node->page.children[rightmost ? node->page.key_count : 0]);
+        page_put(node);
+        node = child;
+    }
+    return node;
+}
+
+unsigned char pbtree_delete(PBTree *tree, unsigned int key)
+{
+    PBTreeFrame *node;
+    PBTreeFrame *child;
+    PBTreeFrame *left;
+    PBTreeFrame *right;
+    PBTreeFrame *leaf;
+    PBTreePage *n;
+    unsigned int target;
+    unsigned char i;
+    unsigned char found;
+    unsigned char depth;
+
+    if (!tree)
+        return 0;
+
+    journal_reserve(tree);
+    found = 0;
+    depth = 1;
+    target = key; /* key becomes the predecessor/successor on the way down */
+    node = page_get(tree, tree->root);
+
+    /* Top-down as in btree.c: every child is topped up before the descent */
+    while (1)
+    {
+        n = &node->page;
+        i = page_find(n, key);
+
+        if (i < n->key_count && key == n->keys[i])
+        {
+            if (n->is_leaf)
+            {
+                for (; i < n->key_count - 1; i++)
+                {
+                    n->keys[i] = n->keys[i + 1];
+                    n->values[i] = n->values[i + 1];
+                }
+                n->key_count--;
+                node->dirty = 1;
+                found = 1;
+                break;
+            }
+
+            /* Internal page: replace with predecessor or successor; otherwise merge */
+            left = page_get(tree, n->children[i]);
+            right = page_get(tree, n->children[i + 1]);
+
+            if (left->page.key_count > PBTREE_MIN_KEYS)
+            {
+                page_put(right);
+                leaf = page_edge(tree, left, 1);
+                key = leaf->page.keys[leaf->page.key_count - 1];
+                n->values[i] = leaf->page.values[leaf->page.key_count - 1];
+                child = left;
+            }
+            else if (right->page.key_count > PBTREE_MIN_KEYS)
+            {
+                page_put(left);
+                leaf = page_edge(tree, right, 0);
+                key = leaf->page.keys[0];
+                n->values[i] = leaf->page.values[0];
+                child = right;
+            }
+            else
+            {
+                merge_children(tree, node, i, left, right);
+                page_put(node);
+                node = left;
+                depth++;
+                continue;
+            }
+
+            n->keys[i] = key;
+            node->dirty = 1;
+            page_put(leaf);
+            page_put(node);
+            node = child;
+            depth++;
+            continue;
+        }
+
+        if (n->is_leaf)
+            break; /* Not found */
+
+        child = page_get(tree, n->children[i]);
+
+        if (child->page.key_count <= PBTREE_MIN_KEYS)
+        {
+            left = NULL;
+            if (i > 0)
+                left = page_get(tree, n->children[i - 1]);
+
+            if (left && left->page.key_count > PBTREE_MIN_KEYS)
+                borrow_left(node, i, left, child);
+            else
+            {
+                right = NULL;
+                if (i < n->key_count)
+                    right = page_get(tree, n->children[i + 1]);
+
+                if (right && right->page.key_count > PBTREE_MIN_KEYS)
+                {
+                    borrow_right(node, i, child, right);
+                    page_put(right);
+                }
+                else if (right)
+                    merge_children(tree, node, i, child, right);
+                else
+                {
+                    merge_children(tree, node, (unsigned char)(i - 1), left, child);
+                    child = left;
+                    left = NULL;
+                }
+            }
+
+            if (left)
+                page_put(left);
+        }
+
+        page_put(node);
+        node = child;
+        depth++;
+    }
+
+    page_put(node);
+
+    /* Only ever raised: a delete that collapses the root leaves it one
+     * high, which journal_reserve() can afford
+     */
+    if (depth > tree->height)
+        tree->height = depth;
+
+    /* A merge at the root can leave it empty: its only child takes over */
+    node = page_get(tree, tree->root);
+    if (node->page.key_count == 0 && !node->page.is_leaf)
+    {
+        tree->root = node->page.children[0];
+        page_release(tree, node);
+    }
+    else
+        page_put(node);
+
+    if (found)
+        journal_log(tree, JOURNAL_DELETE, target, 0);
+    return found;
+}
+
+/* Release page id and everything below it. Children left at
+ * PBTREE_NO_PAGE by an unfinished build are skipped.
+ */
+static void page_free_tree(PBTree *tree, unsigned int id)
+{
+    unsigned int path[PBTREE_MAX_HEIGHT];
+    unsigned char next[PBTREE_MAX_HEIGHT];
+    PBTreeFrame *frame;
+    unsigned int child;
+    unsigned char top;
+
+    path[0] = id;
+    next[0] = 0;
+    top = 0;
+
+    while (1)
+    {
+        frame = page_get(tree, path[top]);
+
+        if (frame->page.is_leaf || next[top] > frame->page.key_count || top + 1 >= PBTREE_MAX_HEIGHT)
+        {
+            page_release(tree, frame);
+            if (top == 0)
+                break;
+            top--;
+            continue;
+        }
+
+        child = frame->page.children[next[top]];
+        next[top]++;
+        page_put(frame);
+
+        if (child != PBTREE_NO_PAGE)
+        {
+            top++;
+            path[top] = child;
+            next[top] = 0;
+        }
+    }
+}
+
+/* Bottom-up build, planned level by level as in btree_bulk.c */
+typedef struct
+{
+    unsigned char levels;
+    unsigned char base[PBTREE_MAX_HEIGHT];
+    unsigned int extra[PBTREE_MAX_HEIGHT];
+    unsigned int made[PBTREE_MAX_HEIGHT];
+    PBTreeFrame *open[PBTREE_MAX_HEIGHT];
+} PageBuild;
+
+/* Plan full pages; returns the number of pages needed, 0 if too tall */
+static unsigned int build_plan(PageBuild *plan, unsigned int n)
+{
+    unsigned int c;
+    unsigned int keys;
+    unsigned int total;
+    unsigned char l;
+
+    l = 0;
+    total = 0;
+    do
+    {
+        if (l >= PBTREE_MAX_HEIGHT)
+            return 0;
+
+        /* c pages hold n - (c - 1) keys, the separators move up */
+        c = (unsigned int)(((unsigned long)n + 1 + PBTREE_MAX_KEYS) / (PBTREE_MAX_KEYS + 1));
+        keys = n - (c - 1);
+        plan->base[l] = (unsigned char)(keys / c);
+        plan->extra[l] = keys % c;
+        plan->made[l] = 0;
+        plan->open[l] = NULL;
+        total += c;
+        l++;
+
+        n = c - 1;
+    } while (c > 1);
+
+    plan->levels = l;
+    return total;
+}
+
+/* Hang every open page below `above` under its parent and unpin it */
+static void build_close(PageBuild *plan, unsigned char above)
+{
+    PBTreeFrame *parent;
+    unsigned char l;
+
+    for (l = 0; l < above; l++)
+    {
+        parent = plan->open[l + 1];
+        parent->page.children[parent->page.key_count] = plan->open[l]->id;
+        page_put(plan->open[l]);
+        plan->open[l] = NULL;
+    }
+}
+
+static void build_discard(PBTree *tree, PageBuild *plan)
+{
+    unsigned int top;
+    unsigned char l;
+
+    top = PBTREE_NO_PAGE;
+    for (l = 0; l < plan->levels; l++)
+    {
+        if (!plan->open[l])
+            continue;
+
+        if (l + 1 < plan->levels && plan->open[l + 1])
+            plan->open[l + 1]->page.children[plan->open[l + 1]->page.key_count] = plan->open[l]->id;
+        top = plan->open[l]->id;
+        page_put(plan->open[l]);
+    }
+
+    if (top != PBTREE_NO_PAGE)
+        page_free_tree(tree, top);
+    tree_new_root(tree);
+}
+
+static unsigned char build_pages(PBTree *tree, unsigned int n, PBTreeSource next, void *ctx)
+{
+    PageBuild plan;
+    PBTreeFrame *frame;
+    unsigned int i;
+    unsigned int key;
+    unsigned int value;
+    unsigned int last;
+    unsigned char l;
+
+    frame = page_get(tree, tree->root);
+    if (!frame->page.is_leaf || frame->page.key_count != 0)
+    {
+        page_put(frame);
+        return 0;
+    }
+    if (n == 0)
+    {
+        page_put(frame);
+        return 1;
+    }
+
+    /* Check space up front. Every open level holds a pinned frame, plus
+     * one for a page being started.
+     */
+    l = 0;
+    i = build_plan(&plan, n);
+    if (i == 0 || i > tree->pages - tree->used + 1 || plan.levels >= PBTREE_CACHE_PAGES)
+    {
+        page_put(frame);
+        return 0;
+    }
+    page_release(tree, frame);
+
+    last = 0;
+    for (i = 0; i < n; i++)
+    {
+        if (!next(&key, &value, ctx) || (i > 0 && key <= last))
+        {
+            build_discard(tree, &plan);
+            return 0;
+        }
+        last = key;
+
+        /* Lowest level whose open page has room */
+        l = 0;
+        while (l < plan.levels && plan.open[l] &&
+               plan.open[l]->page.key_count == plan.base[l] + (plan.made[l] <= plan.extra[l] ? 1 : 0))
+            l++;
+
+        if (l == plan.levels)
+        {
+            build_discard(tree, &plan);
+            return 0;
+        }
+
+        frame = plan.open[l];
+        if (!frame)
+        {
+            frame = page_new(tree, (unsigned char)(l == 0));
+            if (!frame)
+            {
+                build_discard(tree, &plan);
+                return 0;
+            }
+            plan.open[l] = frame;
+            plan.made[l]++;
+        }
+
+        /* The pages below are complete now */
+        build_close(&plan, l);
+
+        frame->page.keys[frame->page.key_count] = key;
+        frame->page.values[frame->page.key_count] = value;
+        frame->page.key_count++;
+    }
+
+    build_close(&plan, (unsigned char)(plan.levels - 1));
+    tree->root = plan.open[plan.levels - 1]->id;
+    page_put(plan.open[plan.levels - 1]);
+    tree->height = plan.levels;
+    return 1;
+}
+
+unsigned char pbtree_build(PBTree *tree, unsigned int n, PBTreeSource next, void *ctx)
+{
+    unsigned char built;
+    int journal_fd;
+
+    if (!tree || !next)
+        return 0;
+
+    /* The build is not journaled and can dirty more pages than the spill
+     * area holds: it starts from a checkpoint, writes its pages straight
+     * to the file and is folded in before the next record.
+     */
+    journal_fd = tree->journal_fd;
+    if (journal_fd >= 0)
+    {
+        checkpoint(tree);
+        tree->journal_fd = -1;
+    }
+
+    built = build_pages(tree, n, next, ctx);
+
+    if (journal_fd >= 0)
+    {
+        tree->journal_fd = journal_fd;
+        checkpoint(tree);
+    }
+    return built;
+}
+
+unsigned char pbtree_stats(PBTree *tree, PBTreeStats *stats)
+{
+    if (!tree || !stats)
+        return 0;
+
+    stats->pages = tree->pages;
+    stats->used = tree->used;
+    stats->hits = tree->hits;
+    stats->misses = tree->misses;
+    stats->writes = tree->writes;
+    stats->io_errors = tree->io_errors;
+    stats->flushes = tree->flushes;
+    stats->checkpoints = tree->checkpoints;
+    stats->spills = tree->spills;
+    return 1;
+}
+
+void pbtree_free(PBTree *tree)
+{
+    if (!tree)
+        return;
+
+    if (tree->fd >= 0)
+    {
+        pbtree_sync(tree);
+        if (tree->journal_fd >= 0)
+            file_close(tree->journal_fd);
+        file_close(tree->fd);
+    }
+    if (spill_owner == tree)
+        spill_owner = NULL;
+    free(tree);
+}
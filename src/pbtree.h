@@ -0,0 +1,211 @@
+#ifndef PBTREE_H
+#define PBTREE_H
+
+#include "btree.h"
+
+/* Paged B-tree for RP6502
+ * Nodes live in fixed-size pages outside 6502 main RAM and are addressed
+ * by 16-bit page numbers. A small LRU cache of page frames in main RAM
+ * holds the pages an operation is working on; everything else stays in
+ * the backing store, so the tree can grow far beyond the heap.
+ * Keys and values are 16-bit. Same top-down split/merge as btree.c.
+ */
+
+/* Page images are little-endian 16-bit fields:
+ * key_count, is_leaf, keys[], values[], children[]
+ */
+#ifndef PBTREE_PAGE_SIZE
+#define PBTREE_PAGE_SIZE 128
+#endif
+#define PBTREE_MAX_KEYS ((PBTREE_PAGE_SIZE - 4) / 6)
+#define PBTREE_MAX_CHILDREN (PBTREE_MAX_KEYS + 1)
+#define PBTREE_MIN_KEYS ((PBTREE_MAX_KEYS - 1) / 2)
+#define PBTREE_SPLIT_INDEX (PBTREE_MAX_KEYS / 2)
+
+#if (PBTREE_MAX_KEYS < 3)
+#error "PBTREE_PAGE_SIZE is too small"
+#endif
+
+/* Page frames cached in main RAM. An operation pins at most four pages
+ * at once (parent, child, sibling and a predecessor walk).
+ */
+#ifndef PBTREE_CACHE_PAGES
+#define PBTREE_CACHE_PAGES 8
+#endif
+
+#if (PBTREE_CACHE_PAGES < 4)
+#error "PBTREE_CACHE_PAGES must be at least 4"
+#endif
+
+/* Page walks use an explicit path of this many levels */
+#ifndef PBTREE_MAX_HEIGHT
+#define PBTREE_MAX_HEIGHT 16
+#endif
+
+/* Journaled page files park dirty pages evicted from the cache in an XRAM
+ * spill area at the top of XRAM until the next checkpoint. An operation
+ * dirties at most three pages per level, so a checkpoint runs before one
+ * starts unless that many slots are left besides the dirty cached pages.
+ */
+#ifndef PBTREE_SPILL_PAGES
+#define PBTREE_SPILL_PAGES 64
+#endif
+#define PBTREE_SPILL_BASE ((unsigned int)(0x10000UL - (unsigned long)PBTREE_SPILL_PAGES * PBTREE_PAGE_SIZE))
+
+#if (PBTREE_SPILL_PAGES < 3 * (PBTREE_MAX_HEIGHT + 1) || PBTREE_SPILL_PAGES > 255)
+#error "PBTREE_SPILL_PAGES must be 3 * (PBTREE_MAX_HEIGHT + 1)..255"
+#endif
+
+/* Default XRAM window: above the buffers used by the MQTT samples and
+ * below the spill area
+ */
+#define PBTREE_XRAM_BASE 0x1000
+#define PBTREE_XRAM_PAGES ((unsigned int)((PBTREE_SPILL_BASE - PBTREE_XRAM_BASE) / PBTREE_PAGE_SIZE))
+
+/* Write-ahead journal for page files. Mutations are appended as
+ * PBTREE_RECORD_SIZE-byte records (op, key, value) and written in groups
+ * of up to PBTREE_JOURNAL_BATCH. Page files name their journal by adding
+ * ".jnl", so paths must be shorter than PBTREE_PATH_MAX - 4.
+ */
+#ifndef PBTREE_JOURNAL_BATCH
+#define PBTREE_JOURNAL_BATCH 16
+#endif
+#define PBTREE_RECORD_SIZE 5
+#define PBTREE_PATH_MAX 32
+
+/* Page number 0 means "no page". In a page file it holds the header. */
+#define PBTREE_NO_PAGE 0
+
+typedef struct
+{
+    unsigned char key_count;
+    unsigned char is_leaf;
+    unsigned int keys[PBTREE_MAX_KEYS];
+    unsigned int values[PBTREE_MAX_KEYS];
+    unsigned int children[PBTREE_MAX_CHILDREN]; /* Page numbers, internal pages only */
+} PBTreePage;
+
+typedef struct
+{
+    PBTreePage page;
+    unsigned int id;           /* Cached page number, PBTREE_NO_PAGE if unused */
+    unsigned int stamp;        /* Last use, for LRU eviction */
+    unsigned char pins;        /* Frames in use by the running operation are never evicted */
+    unsigned char dirty;       /* Page differs from the backing store */
+} PBTreeFrame;
+
+typedef struct
+{
+    unsigned int pages;        /* Pages in the backing store */
+    unsigned int used;         /* Pages holding nodes */
+    unsigned int hits;         /* Page requests served from the cache */
+    unsigned int misses;       /* Page requests that read the backing store */
+    unsigned int writes;       /* Dirty pages written back */
+    unsigned int io_errors;    /* Failed page file reads or writes */
+    unsigned int flushes;      /* Journal group commits */
+    unsigned int checkpoints;  /* Journal folds into the page file */
+    unsigned int spills;       /* Dirty pages parked in the XRAM spill area */
+} PBTreeStats;
+
+typedef struct
+{
+    unsigned int root;         /* Page number of the root */
+    unsigned int xram_base;    /* XRAM address of page 1 */
+    int fd;                    /* Page file, -1 when pages live in XRAM */
+    unsigned int pages;        /* Pages available in the backing store */
+    unsigned int carved;       /* Highest page number handed out so far */
+    unsigned int free_list;    /* Released pages, linked through their first two bytes */
+    unsigned int used;
+    unsigned int clock;        /* LRU clock */
+    unsigned int hits;
+    unsigned int misses;
+    unsigned int writes;
+    unsigned int io_errors;
+    unsigned int flushes;
+    unsigned int checkpoints;
+    unsigned int spills;
+    unsigned char height;      /* Deepest path seen by an insert or delete */
+    unsigned char spill_count; /* Spill slots in use */
+    unsigned int spill[PBTREE_SPILL_PAGES]; /* Page number held by each spill slot */
+    int journal_fd;            /* Journal file, -1 when not journaling */
+    unsigned long journal_size; /* Bytes already in the journal file */
+    unsigned char journal_group; /* Records per group commit */
+    unsigned char journal_count; /* Records waiting in journal_buf */
+    unsigned char replaying;   /* Applying the journal on open */
+    unsigned char journal_buf[PBTREE_JOURNAL_BATCH * PBTREE_RECORD_SIZE];
+    char journal_path[PBTREE_PATH_MAX];
+    PBTreeFrame frames[PBTREE_CACHE_PAGES];
+} PBTree;
+
+/* Create an empty tree in pages XRAM pages starting at xram_base. The
+ * window is cut short at PBTREE_SPILL_BASE; NULL if it starts there.
+ */
+PBTree *pbtree_create(unsigned int xram_base, unsigned int pages);
+
+/* Create an empty tree in a new page file, replacing any existing file */
+PBTree *pbtree_create_file(const char *path);
+
+/* Open a page file. Only the header is read; pages load on first use. */
+PBTree *pbtree_open(const char *path);
+
+/* Write dirty cached pages and the header of a page file, returns 0 on
+ * I/O errors. On a journaled tree this is a checkpoint: the journal is
+ * flushed, spilled and cached dirty pages are folded into the page file
+ * and the journal is emptied. A checkpoint also runs between operations
+ * once the spill area runs low. It rewrites pages in place and is not
+ * atomic; a crash during one can damage the file.
+ */
+unsigned char pbtree_sync(PBTree *tree);
+
+/* Start journaling a page file tree: every successful insert, update and
+ * delete is appended to "<path>.jnl" and written in groups of group
+ * records (1..PBTREE_JOURNAL_BATCH). Dirty pages then stay in the cache
+ * or the XRAM spill area until a checkpoint, so the page file always holds
+ * the last checkpoint and pbtree_open() replays the journal on top of it.
+ * Records written before a crash survive it; the ones still waiting for
+ * their group do not. A group of 0 stops journaling. Returns 0 for XRAM
+ * trees or if the journal cannot be created.
+ */
+unsigned char pbtree_journal(PBTree *tree, unsigned char group);
+
+/* Write the pending journal group now */
+unsigned char pbtree_flush(PBTree *tree);
+
+/* Supplies the next key/value of a sorted stream, returns 0 at the end */
+typedef unsigned char (*PBTreeSource)(unsigned int *key, unsigned int *value, void *ctx);
+
+/* Fill an empty tree bottom-up with n strictly ascending keys from next.
+ * Pages are packed full. Returns 0 (leaving the tree empty) if the tree
+ * is not empty, the stream is short or unsorted, or the store is too small.
+ */
+unsigned char pbtree_build(PBTree *tree, unsigned int n, PBTreeSource next, void *ctx);
+
+/* Insert or replace a key, returns 0 if the backing store is full */
+unsigned char pbtree_insert(PBTree *tree, unsigned int key, unsigned int value);
+
+/* Look up a key, returns 1 and stores its value if present */
+unsigned char pbtree_get(PBTree *tree, unsigned int key, unsigned int *value);
+
+/* Replace the value of an existing key, returns 0 if it is not present */
+unsigned char pbtree_update(PBTree *tree, unsigned int key, unsigned int value);
+
+/* Delete a key, returns 1 if it was present */
+unsigned char pbtree_delete(PBTree *tree, unsigned int key);
+
+/* Copy page and cache statistics into stats */
+unsigned char pbtree_stats(PBTree *tree, PBTreeStats *stats);
+
+/* Free the tree and its cache. Page files are synced and closed;
+ * XRAM is left as is.
+ */
+void pbtree_free(PBTree *tree);
+
+/* Write tree to a page file at path, returns 0 on failure. Values are
+ * stored as 16-bit numbers, so pointers into RAM do not survive a reboot.
+ */
+unsigned char btree_save(BTree *tree, const char *path);
+
+/* Open a tree written by btree_save() for lazy page-by-page access */
+PBTree *btree_open(const char *path);
+
+#endif